@@ -45,6 +45,28 @@ Building::Building(Game *game, unsigned int index) : GameObject(game, index) {
   serf_index = 0;
 }
 
+void
+Building::set_owner(unsigned int owner) {
+  unsigned int old_owner = get_owner();
+  bld = (bld & 0xfc) | owner;
+  game->building_owner_changed(this, old_owner);
+  state_changed();
+}
+
+void
+Building::done_leveling() {
+  progress = 1;
+  state_changed();
+  /* Large buildings can be built next to it at other heights now. */
+  game->invalidate_build_possibilities(pos);
+}
+
+/* Called when state that update() depends on has changed. */
+void
+Building::state_changed() {
+  game->wake_building(index);
+}
+
 Map::Object
 Building::start_building(Type type) {
   const int construction_cost[] = {
@@ -101,6 +123,7 @@ Building::start_building(Type type) {
     stock[1].prio = 0;
     stock[1].maximum = construction_cost[2*type+1];
   }
+  state_changed();
 
   return map_obj;
 }
@@ -177,6 +200,7 @@ Building::cancel_transported_resource(Resource::Type res) {
   if (in_stock >= 0) {
     stock[in_stock].requested -= 1;
     assert(stock[in_stock].requested >= 0);
+    state_changed();
   } else {
     assert(has_inventory());
   }
@@ -194,6 +218,7 @@ Building::add_requested_resource(Resource::Type res, bool fix_priority) {
         stock[j].prio = 0;
       }
       stock[j].requested += 1;
+      state_changed();
       return true;
     }
   }
@@ -207,6 +232,7 @@ Building::stock_init(unsigned int stock_num, Resource::Type type,
   stock[stock_num].type = type;
   stock[stock_num].prio = 0;
   stock[stock_num].maximum = maximum;
+  state_changed();
 }
 
 void
@@ -216,6 +242,7 @@ Building::requested_resource_delivered(Resource::Type resource) {
       stock[i].available += 1;
       stock[i].requested -= 1;
       assert(stock[i].requested >= 0);
+      state_changed();
       return;
     }
   }
@@ -281,6 +308,31 @@ Building::update(unsigned int tick) {
   }
 }
 
+/* Whether update() would only repeat what its previous run did until
+   state_changed() is called or the distribution priorities of the
+   owner change. Such buildings are skipped by Game::update_buildings().
+   This is the case when the building has or awaits its serf and the
+   update only sets the priorities of the stocks: for production
+   buildings that are done and for all buildings under construction. */
+bool
+Building::is_settled() {
+  if (is_burning()) return false;
+  if (!has_serf() && !serf_requested()) return false;
+
+  switch (type) {
+    case TypeNone:
+    case TypeCastle:
+      return false;
+    case TypeStock:
+    case TypeHut:
+    case TypeTower:
+    case TypeFortress:
+      return !is_done();
+    default:
+      return true;
+  }
+}
+
 void
 Building::knight_request_granted() {
   stock[0].requested += 1;
@@ -293,6 +345,7 @@ Building::remove_stock() {
   stock[0].requested = 0;
   stock[1].available = 0;
   stock[1].requested = 0;
+  state_changed();
 }
 
 int
@@ -314,6 +367,7 @@ bool
 Building::use_resource_in_stock(int stock_num) {
   if (stock[stock_num].available > 0) {
     stock[stock_num].available -= 1;
+    state_changed();
     return true;
   }
   return false;
@@ -325,6 +379,7 @@ Building::use_resources_in_stocks() {
       stock[1].available > 0) {
     stock[0].available -= 1;
     stock[1].available -= 1;
+    state_changed();
     return true;
   }
   return false;
@@ -831,7 +886,7 @@ Building::update_unfinished_adv() {
 
   if (!need_leveling) {
     /* Already at the correct level, don't send digger */
-    progress = 1;
+    done_leveling();
     update_unfinished();
     return;
   }
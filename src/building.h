@@ -115,24 +115,24 @@ class Building : public GameObject {
 
   /* Type of building. */
   Type get_type() { return type; }
-  void set_type(Type type) { this->type = type; }
+  void set_type(Type type) { this->type = type; state_changed(); }
   bool is_military() { return (type == TypeHut) ||
                               (type == TypeTower) ||
                               (type == TypeFortress) ||
                               (type == TypeCastle); }
   /* Owning player of the building. */
   unsigned int get_owner() { return (bld & 3); }
-  void set_owner(unsigned int owner) { bld = (bld & 0xfc) | owner; }
+  void set_owner(unsigned int owner);
   /* Whether construction of the building is finished. */
   bool is_done() { return !((bld >> 7) & 1); }
   bool is_leveling() { return (!is_done() && progress == 0); }
-  void done_build() { bld &= ~BIT(7); }
-  void done_leveling() { progress = 1; }
+  void done_build() { bld &= ~BIT(7); state_changed(); }
+  void done_leveling();
   Map::Object start_building(Type type);
   int get_progress() { return progress; }
-  void increase_progress(int delta) { progress += delta; }
+  void increase_progress(int delta) { progress += delta; state_changed(); }
   void increase_mining() { progress = (progress << 1) & 0xffff; }
-  void drop_progress() { progress = 0; }
+  void drop_progress() { progress = 0; state_changed(); }
   void set_under_attack() { progress |= BIT(0); }
   bool is_under_attack() { return BIT_TEST(progress, 0); }
 
@@ -150,16 +150,16 @@ class Building : public GameObject {
   void stop_activity() { serf &= ~BIT(4); }
   /* Building is burning. */
   bool is_burning() { return (BIT_TEST(serf, 5) != 0); }
-  void burnup() { serf |= BIT(5); }
+  void burnup() { serf |= BIT(5); state_changed(); }
   /* Building has an associated serf. */
   bool has_serf() { return (BIT_TEST(serf, 6) != 0); }
-  void serf_arrive() { serf |= BIT(6); }
-  void serf_gone() { serf &= ~BIT(6); }
+  void serf_arrive() { serf |= BIT(6); state_changed(); }
+  void serf_gone() { serf &= ~BIT(6); state_changed(); }
   /* Building has succesfully requested a serf. */
   bool serf_requested() { return (BIT_TEST(serf, 7) != 0); }
-  void serf_request_complete() { serf &= ~BIT(7); }
-  void serf_request_failed() { serf &= ~BIT(7); }
-  void request_serf() { serf |= BIT(7); }
+  void serf_request_complete() { serf &= ~BIT(7); state_changed(); }
+  void serf_request_failed() { serf &= ~BIT(7); state_changed(); }
+  void request_serf() { serf |= BIT(7); state_changed(); }
   /* Building has requested a serf but none was available. */
   bool serf_request_fail() { return (BIT_TEST(serf, 2) != 0); }
   void clear_serf_request_failure() { serf &= ~BIT(2); }
@@ -202,26 +202,27 @@ class Building : public GameObject {
   int get_maximum_in_stock(int stock_num) { return stock[stock_num].maximum; }
   int get_requested_in_stock(int stock_num) {
     return stock[stock_num].requested; }
+  int get_priority_in_stock(int stock_num) { return stock[stock_num].prio; }
   void set_priority_in_stock(int stock_num, int priority) {
-    stock[stock_num].prio = priority; }
+    stock[stock_num].prio = priority; state_changed(); }
   void set_initial_res_in_stock(int stock_num, int count) {
-    stock[stock_num].available = count; }
+    stock[stock_num].available = count; state_changed(); }
   void requested_resource_delivered(Resource::Type resource);
   void plank_used_for_build() {
-    stock[0].available -= 1; stock[0].maximum -= 1; }
+    stock[0].available -= 1; stock[0].maximum -= 1; state_changed(); }
   void stone_used_for_build() {
-    stock[1].available -= 1; stock[1].maximum -= 1; }
+    stock[1].available -= 1; stock[1].maximum -= 1; state_changed(); }
   bool use_resource_in_stock(int stock_num);
   bool use_resources_in_stocks();
   void decrease_requested_for_stock(int stock_num) {
-    stock[stock_num].requested -= 1; }
+    stock[stock_num].requested -= 1; state_changed(); }
 
   int pigs_count() { return stock[1].available; }
-  void send_pig_to_butcher() { stock[1].available -= 1; }
-  void place_new_pig() { stock[1].available += 1; }
+  void send_pig_to_butcher() { stock[1].available -= 1; state_changed(); }
+  void place_new_pig() { stock[1].available += 1; state_changed(); }
 
-  void boat_clear() { stock[1].available = 0; }
-  void boat_do() { stock[1].available++; }
+  void boat_clear() { stock[1].available = 0; state_changed(); }
+  void boat_do() { stock[1].available++; state_changed(); }
 
   void requested_knight_arrived();
   void requested_knight_attacking_on_walk() { stock[0].requested -= 1; }
@@ -232,6 +233,7 @@ class Building : public GameObject {
   void knight_occupy();
 
   void update(unsigned int tick);
+  bool is_settled();
 
   friend SaveReaderBinary&
     operator >> (SaveReaderBinary &reader, Building &building);
@@ -241,6 +243,7 @@ class Building : public GameObject {
     operator << (SaveWriterText &writer, Building &building);
 
  private:
+  void state_changed();
   void update();
   void update_unfinished();
   void update_unfinished_adv();
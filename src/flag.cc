@@ -23,6 +23,7 @@
 
 #include <cassert>
 #include <algorithm>
+#include <climits>
 
 #include "src/game.h"
 #include "src/savegame.h"
@@ -34,6 +35,7 @@
 FlagSearch::FlagSearch(Game *game) {
   this->game = game;
   id = game->next_search_id();
+  head = 0;
 }
 
 void
@@ -42,26 +44,32 @@ FlagSearch::add_source(Flag *flag) {
   flag->search_num = id;
 }
 
+/* Breadth first search from the sources. The queue is consumed from
+   head instead of erasing its front, and only the directions allowed
+   by the land and transporter bitmaps are examined. */
 bool
 FlagSearch::execute(flag_search_func *callback, bool land,
                     bool transporter, void *data) {
-  for (int i = 0; i < SEARCH_MAX_DEPTH && !queue.empty(); i++) {
-    Flag *flag = queue.front();
-    queue.erase(queue.begin());
+  for (int i = 0; i < SEARCH_MAX_DEPTH && head < queue.size(); i++) {
+    Flag *flag = queue[head++];
 
     if (callback(flag, data)) {
       /* Clean up */
       queue.clear();
+      head = 0;
       return true;
     }
 
-    for (int i = 0; i < 6; i++) {
-      if ((!land || !flag->is_water_path((Direction)(5-i))) &&
-          (!transporter || flag->has_transporter((Direction)(5-i))) &&
-          flag->other_endpoint.f[5-i]->search_num != id) {
-        flag->other_endpoint.f[5-i]->search_num = id;
-        flag->other_endpoint.f[5-i]->search_dir = flag->search_dir;
-        Flag *other_flag = flag->other_endpoint.f[5-i];
+    int dirs = (land ? flag->land_paths() : 0x3f) &
+               (transporter ? flag->transporters() : 0x3f);
+    for (int d = DirectionUp; dirs != 0 && d >= DirectionRight; d--) {
+      if (!BIT_TEST(dirs, d)) continue;
+      dirs &= ~BIT(d);
+
+      Flag *other_flag = flag->other_endpoint.f[d];
+      if (other_flag->search_num != id) {
+        other_flag->search_num = id;
+        other_flag->search_dir = flag->search_dir;
         queue.push_back(other_flag);
       }
     }
@@ -69,6 +77,7 @@ FlagSearch::execute(flag_search_func *callback, bool land,
 
   /* Clean up */
   queue.clear();
+  head = 0;
 
   return false;
 }
@@ -85,6 +94,7 @@ Flag::Flag(Game *game, unsigned int index) : GameObject(game, index) {
   pos = 0;
   search_num = 0;
   search_dir = DirectionRight;
+  demand_search_num = 0;
   path_con = 0;
   endpoint = 0;
   transporter = 0;
@@ -98,6 +108,25 @@ Flag::Flag(Game *game, unsigned int index) : GameObject(game, index) {
     other_end_dir[i] = 0;
     other_endpoint.f[i] = 0;
   }
+  nearest_inventory_for_resource = -1;
+  nearest_inventory_for_serf = -1;
+  nearest_inventory_for_resource_epoch = 0;
+  nearest_inventory_for_serf_epoch = 0;
+  failed_serf_search = -1;
+  failed_serf_search_network_epoch = 0;
+  failed_serf_search_inventory_epoch = 0;
+}
+
+void
+Flag::set_owner(unsigned int owner) {
+  path_con = (owner << 6) | (path_con & 0x3f);
+
+  /* Cached search results were made with the epochs of the previous
+     owner, which say nothing about the network of the new owner. */
+  nearest_inventory_for_resource_epoch = 0;
+  nearest_inventory_for_serf_epoch = 0;
+  failed_serf_search_network_epoch = 0;
+  failed_serf_search_inventory_epoch = 0;
 }
 
 void
@@ -109,6 +138,7 @@ Flag::add_path(Direction dir, bool water) {
     endpoint |= BIT(dir);
   }
   transporter &= ~BIT(dir);
+  roads_changed();
 }
 
 void
@@ -116,6 +146,7 @@ Flag::del_path(Direction dir) {
   path_con &= ~BIT(dir);
   endpoint &= ~BIT(dir);
   transporter &= ~BIT(dir);
+  roads_changed();
 
   if (serf_requested(dir)) {
     cancel_serf_request(dir);
@@ -160,6 +191,7 @@ Flag::drop_resource(Resource::Type res, unsigned int dest) {
       slot[i].dest = dest;
       slot[i].dir = DirectionNone;
       endpoint |= BIT(7);
+      transport_changed();
       return true;
     }
   }
@@ -216,6 +248,12 @@ typedef struct ScheduleUnknownDestData {
   Resource::Type resource;
   int max_prio;
   Flag *flag;
+  /* Flags of requesting buildings, if known, and how many of them
+     have not been visited yet. The flags are marked with the search
+     id. */
+  const std::vector<unsigned int> *demand;
+  unsigned int search_id;
+  int remaining;
 } ScheduleUnknownDestData;
 
 static bool
@@ -232,6 +270,14 @@ schedule_unknown_dest_cb(Flag *flag, void *data) {
     }
 
     if (dest_data->max_prio > 204) return true;
+
+    /* No other flag can be chosen once all requesting buildings have
+       been visited. */
+    if (bld_prio > 0 && dest_data->demand != NULL &&
+        flag->is_demanded_by_search(dest_data->search_id)) {
+      dest_data->remaining -= 1;
+      if (dest_data->remaining == 0) return true;
+    }
   }
 
   return false;
@@ -274,9 +320,6 @@ Flag::schedule_slot_to_unknown_dest(int slot_num) {
 
   Resource::Type res = slot[slot_num].type;
   if (routable[res]) {
-    FlagSearch search(game);
-    search.add_source(this);
-
     /* Handle food as one resource group */
     if (res == Resource::TypeMeat ||
         res == Resource::TypeFish ||
@@ -288,8 +331,36 @@ Flag::schedule_slot_to_unknown_dest(int slot_num) {
     data.resource = res;
     data.flag = NULL;
     data.max_prio = 0;
+    data.demand = game->get_resource_demand(get_owner(), res);
+    data.remaining = -1;
+
+    /* During the flag update the buildings requesting the resource
+       are known. The search is skipped if none of them is left. */
+    if (data.demand != NULL) {
+      data.remaining = 0;
+      for (size_t i = 0; i < data.demand->size(); i++) {
+        Flag *flag = game->get_flag((*data.demand)[i]);
+        if (flag != NULL && flag->has_building() &&
+            flag->get_building()->get_max_priority_for_resource(res) > 0) {
+          data.remaining += 1;
+        }
+      }
+    }
+
+    if (data.remaining != 0) {
+      FlagSearch search(game);
+      data.search_id = search.get_id();
+      if (data.demand != NULL) {
+        for (size_t i = 0; i < data.demand->size(); i++) {
+          Flag *flag = game->get_flag((*data.demand)[i]);
+          if (flag != NULL) flag->demand_search_num = data.search_id;
+        }
+      }
+
+      search.add_source(this);
+      search.execute(schedule_unknown_dest_cb, false, true, &data);
+    }
 
-    search.execute(schedule_unknown_dest_cb, false, true, &data);
     if (data.flag != NULL) {
       Log::Verbose["game"] << "dest for flag " << index << " res " << slot
                            << " found: flag " << data.flag->get_index();
@@ -352,12 +423,19 @@ find_nearest_inventory_search_cb(Flag *flag, void *data) {
 /* Return the flag index of the inventory nearest to flag. */
 int
 Flag::find_nearest_inventory_for_resource() {
+  uint32_t epoch = game->get_flag_network_epoch(get_owner());
+  if (nearest_inventory_for_resource_epoch == epoch) {
+    return nearest_inventory_for_resource;
+  }
+
   Flag *dest = NULL;
   FlagSearch::single(this, find_nearest_inventory_search_cb, false, true,
                      &dest);
-  if (dest != NULL) return dest->get_index();
 
-  return -1;
+  nearest_inventory_for_resource = (dest != NULL) ? dest->get_index() : -1;
+  nearest_inventory_for_resource_epoch = epoch;
+
+  return nearest_inventory_for_resource;
 }
 
 static bool
@@ -374,13 +452,39 @@ flag_search_inventory_search_cb(Flag *flag, void *data) {
 
 int
 Flag::find_nearest_inventory_for_serf() {
+  uint32_t epoch = game->get_flag_network_epoch(get_owner());
+  if (nearest_inventory_for_serf_epoch == epoch) {
+    return nearest_inventory_for_serf;
+  }
+
   int dest_index = -1;
   FlagSearch::single(this, flag_search_inventory_search_cb, true, false,
                      &dest_index);
 
+  nearest_inventory_for_serf = dest_index;
+  nearest_inventory_for_serf_epoch = epoch;
+
   return dest_index;
 }
 
+/* Whether the serf request identified by key has failed since the flag
+   network and the inventories of the owner last changed. */
+bool
+Flag::is_serf_search_failed(int key) {
+  return (failed_serf_search == key &&
+          failed_serf_search_network_epoch ==
+            game->get_flag_network_epoch(get_owner()) &&
+          failed_serf_search_inventory_epoch ==
+            game->get_inventory_epoch(get_owner()));
+}
+
+void
+Flag::set_serf_search_failed(int key) {
+  failed_serf_search = key;
+  failed_serf_search_network_epoch = game->get_flag_network_epoch(get_owner());
+  failed_serf_search_inventory_epoch = game->get_inventory_epoch(get_owner());
+}
+
 typedef struct ScheduleKnownDestData {
   Flag *src;
   Flag *dest;
@@ -424,16 +528,30 @@ Flag::schedule_known_dest_cb_(Flag *src, Flag *dest, int _slot) {
   return 0;
 }
 
+/* Add flag as a source of the search for the destination of a resource
+   at src, unless it already is one. */
+static void
+add_known_dest_source(Flag *src, Flag *flag, Direction dir,
+                      Flag *sources[], Direction dirs[], int *count) {
+  if (flag == src) return;
+  for (int i = 0; i < *count; i++) {
+    if (sources[i] == flag) return;
+  }
+
+  sources[*count] = flag;
+  dirs[*count] = dir;
+  *count += 1;
+}
+
 void
 Flag::schedule_slot_to_known_dest(int slot, unsigned int res_waiting[4]) {
-  FlagSearch search(game);
+  /* Neighbour flags in the order they are searched from. */
+  Flag *sources[6];
+  Direction dirs[6];
+  int count = 0;
 
-  search_num = search.get_id();
-  search_dir = DirectionUpRight;
   int tr = transporters();
 
-  int sources = 0;
-
   /* Directions where transporters are idle (zero slots waiting) */
   int flags = (res_waiting[0] ^ 0x3f) & transporter;
 
@@ -441,12 +559,8 @@ Flag::schedule_slot_to_known_dest(int slot, unsigned int res_waiting[4]) {
     for (int k = 0; k < 6; k++) {
       if (BIT_TEST(flags, 5-k)) {
         tr &= ~BIT(5-k);
-        Flag *other_flag = other_endpoint.f[5-k];
-        if (other_flag->search_num != search.get_id()) {
-          other_flag->search_dir = (Direction)(5-k);
-          search.add_source(other_flag);
-          sources += 1;
-        }
+        add_known_dest_source(this, other_endpoint.f[5-k], (Direction)(5-k),
+                              sources, dirs, &count);
       }
     }
   }
@@ -457,12 +571,8 @@ Flag::schedule_slot_to_known_dest(int slot, unsigned int res_waiting[4]) {
       for (int k = 0; k < 6; k++) {
         if (BIT_TEST(flags, 5-k)) {
           tr &= ~BIT(5-k);
-          Flag *other_flag = other_endpoint.f[5-k];
-          if (other_flag->search_num != search.get_id()) {
-            other_flag->search_dir = (Direction)(5-k);
-            search.add_source(other_flag);
-            sources += 1;
-          }
+          add_known_dest_source(this, other_endpoint.f[5-k],
+                                (Direction)(5-k), sources, dirs, &count);
         }
       }
     }
@@ -472,25 +582,42 @@ Flag::schedule_slot_to_known_dest(int slot, unsigned int res_waiting[4]) {
       for (int k = 0; k < 6; k++) {
         if (BIT_TEST(flags, 5-k)) {
           tr &= ~BIT(5-k);
-          Flag *other_flag = other_endpoint.f[5-k];
-          if (other_flag->search_num != search.get_id()) {
-            other_flag->search_dir = (Direction)(5-k);
-            search.add_source(other_flag);
-            sources += 1;
-          }
+          add_known_dest_source(this, other_endpoint.f[5-k],
+                                (Direction)(5-k), sources, dirs, &count);
         }
       }
       if (flags == 0) return;
     }
   }
 
-  if (sources > 0) {
-    ScheduleKnownDestData data;
-    data.src = this;
-    data.dest = game->get_flag(this->slot[slot].dest);
-    data.slot = slot;
-    bool r = search.execute(schedule_known_dest_cb, false, true, &data);
-    if (!r || data.dest->search_dir == 6) {
+  if (count > 0) {
+    Flag *dest = game->get_flag(this->slot[slot].dest);
+    int first = game->get_flag_routes()->find_first_source(dest, true,
+                                                           sources, count,
+                                                           this);
+    bool r = false;
+    if (first >= 0) {
+      dest->search_dir = dirs[first];
+      r = (dest->schedule_known_dest_cb_(this, dest, slot) != 0);
+    } else if (first == FLAG_ROUTES_UNKNOWN) {
+      /* The route may pass through this flag, which the search does
+         not allow. */
+      FlagSearch search(game);
+      search_num = search.get_id();
+      search_dir = DirectionUpRight;
+      for (int i = 0; i < count; i++) {
+        sources[i]->search_dir = dirs[i];
+        search.add_source(sources[i]);
+      }
+
+      ScheduleKnownDestData data;
+      data.src = this;
+      data.dest = dest;
+      data.slot = slot;
+      r = search.execute(schedule_known_dest_cb, false, true, &data);
+    }
+
+    if (!r || dest->search_dir == 6) {
       /* Unable to deliver */
       game->cancel_transported_resource(this->slot[slot].type,
                                         this->slot[slot].dest);
@@ -612,6 +739,9 @@ Flag::restore_path_serf_info(Direction dir, SerfPathInfo *data) {
     length[dir] |= std::min(data->serf_count, max_serfs);
     other_flag->length[other_dir] |= std::min(data->serf_count, max_serfs);
   }
+
+  other_flag->transport_changed();
+  roads_changed();
 }
 
 bool
@@ -814,6 +944,10 @@ Flag::merge_paths(MapPos pos) {
     flag_2->length[dir_2] += serf_count;
   }
 
+  flag_1->transport_changed();
+  flag_2->transport_changed();
+  roads_changed();
+
   /* Update serfs with reference to this flag. */
   Game::ListSerfs serfs = game->get_serfs_related_to(flag_1->get_index(),
                                                      dir_1);
@@ -872,6 +1006,7 @@ Flag::update() {
   }
 
   /* Update transporter flags, decide if serf needs to be sent to road */
+  int old_transporters = transporters();
   for (int j = 0; j < 6; j++) {
     if (has_path((Direction)(5-j))) {
       if (serf_requested((Direction)(5-j))) {
@@ -899,6 +1034,27 @@ Flag::update() {
       }
     }
   }
+
+  if (transporters() != old_transporters) network_changed();
+}
+
+/* Whether update() would only repeat what its previous run did until
+   transport_changed() is called: no resources are waiting and every
+   path has a transporter or has requested one. */
+bool
+Flag::is_idle() {
+  for (int i = 0; i < FLAG_MAX_RES_COUNT; i++) {
+    if (slot[i].type != Resource::TypeNone) return false;
+  }
+
+  for (int d = DirectionRight; d <= DirectionUp; d++) {
+    if (has_path((Direction)d) && !serf_requested((Direction)d) &&
+        free_transporter_count((Direction)d) == 0) {
+      return false;
+    }
+  }
+
+  return true;
 }
 
 typedef struct SendSerfToRoadData {
@@ -964,6 +1120,7 @@ Flag::call_transporter(Direction dir, bool water) {
 
   length[dir] |= BIT(7);
   src_2->length[dir_2] |= BIT(7);
+  src_2->transport_changed();
 
   Flag *src = this;
   if (dest_flag->search_dir == src_2->search_dir) {
@@ -1008,6 +1165,7 @@ void
 Flag::link_building(Building *building) {
   other_endpoint.b[DirectionUpLeft] = building;
   endpoint |= BIT(6);
+  network_changed();
 }
 
 void
@@ -1015,6 +1173,55 @@ Flag::unlink_building() {
   other_endpoint.b[DirectionUpLeft] = NULL;
   endpoint &= ~BIT(6);
   clear_flags();
+  network_changed();
+}
+
+void
+Flag::set_accepts_resources(bool accepts) {
+  if (accepts == accepts_resources()) return;
+  accepts ? bld2_flags |= BIT(7) : bld2_flags &= ~BIT(7);
+  network_changed();
+}
+
+void
+Flag::set_accepts_serfs(bool accepts) {
+  if (accepts == accepts_serfs()) return;
+  accepts ? bld_flags |= BIT(7) : bld_flags &= ~BIT(7);
+  network_changed();
+}
+
+void
+Flag::set_has_inventory() {
+  if (has_inventory()) return;
+  bld_flags |= BIT(6);
+  network_changed();
+}
+
+void
+Flag::clear_flags() {
+  if (bld_flags == 0 && bld2_flags == 0) return;
+  bld_flags = 0;
+  bld2_flags = 0;
+  network_changed();
+}
+
+/* Invalidate the flag search results of the owner of this flag. */
+void
+Flag::network_changed() {
+  game->flag_network_changed(get_owner());
+}
+
+void
+Flag::roads_changed() {
+  game->road_network_changed(get_owner());
+  transport_changed();
+}
+
+/* Called when resources or transporters that update() depends on have
+   changed. */
+void
+Flag::transport_changed() {
+  game->wake_flag(index);
 }
 
 SaveReaderBinary&
@@ -1175,3 +1382,127 @@ operator << (SaveWriterText &writer, Flag &flag) {
 
   return writer;
 }
+
+FlagRoutes::FlagRoutes(Game *game) {
+  this->game = game;
+  use_counter = 0;
+}
+
+static unsigned int
+get_route_dist(const std::vector<unsigned int> &dist, Flag *flag) {
+  unsigned int index = flag->get_index();
+  return (index < dist.size()) ? dist[index] : UINT_MAX;
+}
+
+/* Return which of the sources a FlagSearch started from all of them,
+   in order, would reach dest from first. That is the first source at
+   the smallest distance. Returns -1 if dest cannot be reached. The
+   search treats the blocked flag as already visited; if it could lie
+   on the shortest route FLAG_ROUTES_UNKNOWN is returned. */
+int
+FlagRoutes::find_first_source(Flag *dest, bool transporter,
+                              Flag *sources[], int count, Flag *blocked) {
+  if (dest == NULL) return -1;
+
+  const Table *table = get_table(dest, transporter);
+
+  int first = -1;
+  unsigned int first_dist = UINT_MAX;
+  for (int i = 0; i < count; i++) {
+    unsigned int dist = get_route_dist(table->dist, sources[i]);
+    if (dist < first_dist) {
+      first = i;
+      first_dist = dist;
+    }
+  }
+
+  /* Routes through the blocked flag are longer than its own distance. */
+  if (first >= 0 && blocked != NULL &&
+      first_dist > get_route_dist(table->dist, blocked)) {
+    return FLAG_ROUTES_UNKNOWN;
+  }
+
+  return first;
+}
+
+/* Get the table for dest, building it if it is missing or out of date.
+   The least recently used table is replaced when all are taken. */
+const FlagRoutes::Table *
+FlagRoutes::get_table(Flag *dest, bool transporter) {
+  unsigned int player = dest->get_owner();
+  uint32_t epoch = transporter ? game->get_flag_network_epoch(player) :
+                                 game->get_road_network_epoch(player);
+  use_counter += 1;
+
+  Table *table = NULL;
+  for (size_t i = 0; i < tables.size(); i++) {
+    if (tables[i].dest == dest->get_index() &&
+        tables[i].transporter == transporter) {
+      table = &tables[i];
+      break;
+    }
+  }
+
+  if (table == NULL) {
+    if (tables.size() < FLAG_ROUTES_MAX_TABLES) {
+      tables.push_back(Table());
+      table = &tables.back();
+    } else {
+      table = &tables[0];
+      for (size_t i = 1; i < tables.size(); i++) {
+        if (tables[i].last_use < table->last_use) table = &tables[i];
+      }
+    }
+    table->dest = dest->get_index();
+    table->transporter = transporter;
+    table->epoch = 0;
+  }
+
+  if (table->epoch != epoch || table->player != player) {
+    build_table(table, dest);
+    table->epoch = epoch;
+    table->player = player;
+  }
+  table->last_use = use_counter;
+
+  return table;
+}
+
+/* Breadth first search backwards from dest over the paths that
+   FlagSearch::execute() would follow. */
+void
+FlagRoutes::build_table(Table *table, Flag *dest) {
+  std::vector<unsigned int> &dist = table->dist;
+  dist.assign(dest->get_index() + 1, UINT_MAX);
+  dist[dest->get_index()] = 0;
+
+  queue.clear();
+  queue.push_back(dest);
+
+  for (size_t head = 0; head < queue.size(); head++) {
+    Flag *flag = queue[head];
+    unsigned int next_dist = dist[flag->get_index()] + 1;
+
+    for (int d = DirectionUp; d >= DirectionRight; d--) {
+      if (!flag->has_path((Direction)d)) continue;
+
+      Flag *other = flag->get_other_end_flag((Direction)d);
+      Direction other_dir = flag->get_other_end_dir((Direction)d);
+      if (other == NULL || other->get_other_end_flag(other_dir) != flag) {
+        continue;
+      }
+
+      if (table->transporter ? !other->has_transporter(other_dir) :
+                               other->is_water_path(other_dir)) {
+        continue;
+      }
+
+      unsigned int index = other->get_index();
+      if (index >= dist.size()) dist.resize(index + 1, UINT_MAX);
+      if (dist[index] != UINT_MAX) continue;
+
+      dist[index] = next_dist;
+      queue.push_back(other);
+    }
+  }
+}
@@ -60,8 +60,11 @@ class Flag : public GameObject {
   int endpoint;
   ResourceSlot slot[FLAG_MAX_RES_COUNT];
 
-  int search_num;
+  unsigned int search_num;
   Direction search_dir;
+  /* Id of the last search that is looking for the building at this
+     flag as a requester of a resource. */
+  unsigned int demand_search_num;
   int transporter;
   size_t length[6];
   union other_endpoint {
@@ -74,6 +77,20 @@ class Flag : public GameObject {
   int bld_flags;
   int bld2_flags;
 
+  /* Results of the nearest inventory searches and the flag network
+     epoch they were found in. The epochs belong to the owner and are
+     reset when the owner changes. */
+  int nearest_inventory_for_resource;
+  int nearest_inventory_for_serf;
+  uint32_t nearest_inventory_for_resource_epoch;
+  uint32_t nearest_inventory_for_serf_epoch;
+
+  /* The last serf request from this flag that found no serf, and the
+     flag network and inventory epochs it was made in. */
+  int failed_serf_search;
+  uint32_t failed_serf_search_network_epoch;
+  uint32_t failed_serf_search_inventory_epoch;
+
  public:
   Flag(Game *game, unsigned int index);
 
@@ -91,8 +108,7 @@ class Flag : public GameObject {
 
   /* Owner of this flag. */
   unsigned int get_owner() { return (path_con >> 6) & 3; }
-  void set_owner(unsigned int owner) { path_con = (owner << 6) |
-                                               (path_con & 0x3f); }
+  void set_owner(unsigned int owner);
 
   /* Bitmap showing whether the outgoing paths are land paths. */
   int land_paths() { return endpoint & 0x3f; }
@@ -119,15 +135,18 @@ class Flag : public GameObject {
   /* Current number of transporters on path. */
   unsigned int free_transporter_count(Direction dir) {
     return length[dir] & 0xf; }
-  void transporter_to_serve(Direction dir) { length[dir] -= 1; }
+  void transporter_to_serve(Direction dir) {
+    length[dir] -= 1; transport_changed(); }
   /* Length category of path determining max number of transporters. */
   unsigned int length_category(Direction dir) { return (length[dir] >> 4) & 7; }
   /* Whether a transporter serf was successfully requested for this path. */
   bool serf_requested(Direction dir) { return (length[dir] >> 7) & 1; }
-  void cancel_serf_request(Direction dir) { length[dir] &= ~BIT(7); }
+  void cancel_serf_request(Direction dir) {
+    length[dir] &= ~BIT(7); transport_changed(); }
   void complete_serf_request(Direction dir) {
     length[dir] &= ~BIT(7);
     length[dir] += 1;
+    transport_changed();
   }
 
   /* The slot that is scheduled for pickup by the given path. */
@@ -151,12 +170,10 @@ class Flag : public GameObject {
   /* Whether this inventory accepts serfs. */
   bool accepts_serfs() { return ((bld_flags >> 7) & 1); }
 
-  void set_has_inventory() { bld_flags |= BIT(6); }
-  void set_accepts_resources(bool accepts) { accepts ? bld2_flags |= BIT(7) :
-                                                       bld2_flags &= ~BIT(7); }
-  void set_accepts_serfs(bool accepts) { accepts ? bld_flags |= BIT(7) :
-                                                   bld_flags &= ~BIT(7); }
-  void clear_flags() { bld_flags = 0; bld2_flags = 0; }
+  void set_has_inventory();
+  void set_accepts_resources(bool accepts);
+  void set_accepts_serfs(bool accepts);
+  void clear_flags();
 
   friend SaveReaderBinary&
     operator >> (SaveReaderBinary &reader, Flag &flag);
@@ -179,11 +196,14 @@ class Flag : public GameObject {
 
   int find_nearest_inventory_for_resource();
   int find_nearest_inventory_for_serf();
+  bool is_serf_search_failed(int key);
+  void set_serf_search_failed(int key);
 
   void link_with_flag(Flag *dest_flag, bool water_path, size_t length,
                       Direction in_dir, Direction out_dir);
 
   void update();
+  bool is_idle();
 
   /* Get road length category value for real length.
    Determines number of serfs servicing the path segment.(?) */
@@ -193,7 +213,9 @@ class Flag : public GameObject {
 
   void set_search_dir(Direction dir) { search_dir = dir; }
   Direction get_search_dir() { return search_dir; }
-  void clear_search_id() { search_num = 0; }
+  void clear_search_id() { search_num = 0; demand_search_num = 0; }
+  bool is_demanded_by_search(unsigned int id) const {
+    return (demand_search_num == id); }
 
   bool can_demolish();
 
@@ -203,6 +225,9 @@ class Flag : public GameObject {
                                   SerfPathInfo *data);
 
  protected:
+  void network_changed();
+  void roads_changed();
+  void transport_changed();
   void fix_scheduled();
 
   void schedule_slot_to_unknown_dest(int slot);
@@ -218,12 +243,13 @@ class FlagSearch {
  protected:
   Game *game;
   std::vector<Flag*> queue;
-  int id;
+  size_t head;
+  unsigned int id;
 
  public:
   explicit FlagSearch(Game *game);
 
-  int get_id() { return id; }
+  unsigned int get_id() { return id; }
   void add_source(Flag *flag);
   bool execute(flag_search_func *callback,
                bool land, bool transporter, void *data);
@@ -232,4 +258,47 @@ class FlagSearch {
                      bool land, bool transporter, void *data);
 };
 
+/* Number of destinations that FlagRoutes keeps tables for. */
+#define FLAG_ROUTES_MAX_TABLES  64
+
+/* Returned by FlagRoutes::find_first_source() when the tables cannot
+   tell the answer and a FlagSearch is needed. */
+#define FLAG_ROUTES_UNKNOWN  -2
+
+/* Hop distances from every flag to frequently used destination flags,
+   either over land paths or over paths served by transporters. A table
+   is built with a breadth first search backwards from the destination
+   and kept until the flag network of the owner changes. The tables
+   answer which of a number of sources a FlagSearch would reach the
+   destination from, which is all that routing serfs and resources
+   needs. */
+class FlagRoutes {
+ protected:
+  typedef struct Table {
+    unsigned int dest;
+    bool transporter;
+    unsigned int player;
+    uint32_t epoch;
+    unsigned int last_use;
+    std::vector<unsigned int> dist;
+  } Table;
+
+  Game *game;
+  std::vector<Table> tables;
+  unsigned int use_counter;
+  std::vector<Flag*> queue;
+
+ public:
+  explicit FlagRoutes(Game *game);
+
+  void clear() { tables.clear(); }
+
+  int find_first_source(Flag *dest, bool transporter, Flag *sources[],
+                        int count, Flag *blocked);
+
+ protected:
+  const Table *get_table(Flag *dest, bool transporter);
+  void build_table(Table *table, Flag *dest);
+};
+
 #endif  // SRC_FLAG_H_
@@ -0,0 +1,252 @@
+/*
+ * freeserf-sim.cc - Headless game simulation driver.
+ *
+ * Copyright (C) 2017  Jon Lund Steffensen <jonlst@gmail.com>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Runs the game simulation without any graphics, audio or event loop.
+   Game::update() is called back to back for a fixed number of ticks,
+   which makes it possible to benchmark and profile the simulation
+   itself. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifdef HAVE_GETOPT_H
+# include <getopt.h>
+#endif
+
+#include "src/freeserf.h"
+#include "src/log.h"
+#include "src/game.h"
+#include "src/savegame.h"
+#include "src/random.h"
+
+#define DEFAULT_MAP_SIZE  3
+#define DEFAULT_PLAYERS   2
+#define DEFAULT_TICKS     (10*60*TICKS_PER_SEC)
+#define DEFAULT_SEED      "8667715887436237"
+
+/* Number of attempts at finding a castle position for each player. */
+#define CASTLE_PLACE_ATTEMPTS  10000
+
+#define USAGE                                               \
+  "Usage: %s [-l FILE | -m SIZE -s SEED -p NUM] [-n TICKS]\n"
+#define HELP                                                \
+  USAGE                                                     \
+      " -d NUM\t\tSet debug output level\n"                 \
+      " -h\t\tShow this help text\n"                        \
+      " -l FILE\tLoad saved game\n"                         \
+      " -m SIZE\tRandom map size (3-10)\n"                  \
+      " -n TICKS\tNumber of game updates to run\n"          \
+      " -o FILE\tSave game state to file when done\n"       \
+      " -p NUM\t\tNumber of players on random map (1-4)\n"  \
+      " -r\t\tReport time spent in each update phase\n"    \
+      " -R\t\tReport time spent in each serf state\n"      \
+      " -s SEED\tRandom map seed (16 digits 1-8)\n"         \
+      "\n"                                                  \
+      "Please report bugs to <" PACKAGE_BUGREPORT ">\n"
+
+/* Add players to a freshly generated map and place their castles
+   at random positions where a castle can be built. */
+static bool
+add_players(Game *game, int count, Random *rnd) {
+  const unsigned int default_player_colors[] = {
+    64, 72, 68, 76
+  };
+
+  Map *map = game->get_map();
+
+  for (int i = 0; i < count; i++) {
+    int n = game->add_player(12 + i, default_player_colors[i], 40, 40, 40);
+    Player *player = game->get_player(n);
+
+    bool placed = false;
+    for (int j = 0; j < CASTLE_PLACE_ATTEMPTS && !placed; j++) {
+      MapPos pos = map->get_rnd_coord(NULL, NULL, rnd);
+      if (game->can_build_castle(pos, player)) {
+        placed = game->build_castle(pos, player);
+      }
+    }
+
+    if (!placed) {
+      Log::Error["sim"] << "Unable to place castle for player " << n << ".";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static void
+print_state(Game *game) {
+  Log::Info["sim"] << "Final tick: " << game->get_tick();
+
+  unsigned int owned[GAME_MAX_PLAYER_COUNT];
+  game->get_map()->get_owned_tile_counts(owned);
+
+  for (int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) {
+    Player *player = game->get_player(i);
+    if (player == NULL) continue;
+
+    Log::Info["sim"] << "Player " << i
+                     << ": land " << player->get_land_area()
+                     << ", owned tiles " << owned[i]
+                     << ", buildings "
+                     << game->get_player_buildings(player).size()
+                     << ", serfs " << game->get_player_serfs(player).size()
+                     << ", building score " << player->get_building_score()
+                     << ", military score " << player->get_military_score();
+  }
+}
+
+int
+main(int argc, char *argv[]) {
+  std::string save_file;
+  std::string out_file;
+  std::string seed = DEFAULT_SEED;
+
+  int map_size = DEFAULT_MAP_SIZE;
+  int player_count = DEFAULT_PLAYERS;
+  unsigned int ticks = DEFAULT_TICKS;
+  bool profile = false;
+  bool profile_serfs = false;
+
+#ifdef HAVE_GETOPT_H
+  while (true) {
+    char opt = getopt(argc, argv, "d:hl:m:n:o:p:rRs:");
+    if (opt < 0) break;
+
+    switch (opt) {
+      case 'd': {
+          int d = atoi(optarg);
+          if (d >= 0 && d < Log::LevelMax) {
+            Log::set_level(static_cast<Log::Level>(d));
+          }
+        }
+        break;
+      case 'h':
+        fprintf(stdout, HELP, argv[0]);
+        exit(EXIT_SUCCESS);
+        break;
+      case 'l':
+        if (strlen(optarg) > 0) {
+          save_file = optarg;
+        }
+        break;
+      case 'm':
+        map_size = atoi(optarg);
+        break;
+      case 'n':
+        ticks = atoi(optarg);
+        break;
+      case 'o':
+        if (strlen(optarg) > 0) {
+          out_file = optarg;
+        }
+        break;
+      case 'p':
+        player_count = atoi(optarg);
+        break;
+      case 'r':
+        profile = true;
+        break;
+      case 'R':
+        profile_serfs = true;
+        break;
+      case 's':
+        if (strlen(optarg) != 16) {
+          fprintf(stderr, USAGE, argv[0]);
+          exit(EXIT_FAILURE);
+        }
+        seed = optarg;
+        break;
+      default:
+        fprintf(stderr, USAGE, argv[0]);
+        exit(EXIT_FAILURE);
+        break;
+    }
+  }
+#endif
+
+  if (player_count < 1 || player_count > GAME_MAX_PLAYER_COUNT) {
+    fprintf(stderr, USAGE, argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  Game *game = new Game(0);
+  game->init();
+
+  if (!save_file.empty()) {
+    if (!game->load_save_game(save_file)) exit(EXIT_FAILURE);
+  } else {
+    Random rnd(seed);
+    if (!game->load_random_map(map_size, rnd)) exit(EXIT_FAILURE);
+    game->seed_random(rnd);
+    if (!add_players(game, player_count, &rnd)) exit(EXIT_FAILURE);
+  }
+
+  /* Saved games are stored paused. */
+  game->speed_reset();
+  game->enable_profiler(profile);
+  game->enable_serf_profiler(profile_serfs);
+
+  std::clock_t start = std::clock();
+  for (unsigned int i = 0; i < ticks; i++) {
+    game->update();
+  }
+  std::clock_t end = std::clock();
+
+  double seconds = static_cast<double>(end - start) / CLOCKS_PER_SEC;
+  Log::Info["sim"] << ticks << " updates in " << seconds << " s";
+  if (seconds > 0) {
+    Log::Info["sim"] << ticks / seconds << " updates/s ("
+                     << ticks / seconds / TICKS_PER_SEC << "x real time)";
+  }
+  print_state(game);
+  game->log_object_usage();
+
+  if (game->get_profiler() != NULL) {
+    game->get_profiler()->dump();
+  }
+  if (game->get_serf_profiler() != NULL) {
+    game->get_serf_profiler()->dump();
+  }
+
+  if (!out_file.empty()) {
+    if (!save_state(out_file, game)) {
+      Log::Error["sim"] << "Unable to save game state to `"
+                        << out_file << "'.";
+      delete game;
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  game->enable_profiler(false);
+  game->enable_serf_profiler(false);
+  delete game;
+
+  return EXIT_SUCCESS;
+}
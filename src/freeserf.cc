@@ -113,6 +113,7 @@ save_game(int autosave, Game *game) {
       " -g DATA-FILE\tUse specified data file\n"            \
       " -h\t\tShow this help text\n"                        \
       " -l FILE\tLoad saved game\n"                         \
+      " -p\t\tProfile game updates and serf states\n"       \
       " -r RES\t\tSet display resolution (e.g. 800x600)\n"  \
       " -t GEN\t\tMap generator (0 or 1)\n"                 \
       "\n"                                                  \
@@ -127,10 +128,11 @@ main(int argc, char *argv[]) {
   int screen_height = DEFAULT_SCREEN_HEIGHT;
   bool fullscreen = false;
   int map_generator = 0;
+  bool profile = false;
 
 #ifdef HAVE_GETOPT_H
   while (true) {
-    char opt = getopt(argc, argv, "d:fg:hl:r:t:");
+    char opt = getopt(argc, argv, "d:fg:hl:pr:t:");
     if (opt < 0) break;
 
     switch (opt) {
@@ -158,6 +160,9 @@ main(int argc, char *argv[]) {
           save_file = optarg;
         }
         break;
+      case 'p':
+        profile = true;
+        break;
       case 'r': {
           char *hstr = strchr(optarg, 'x');
           if (hstr == NULL) {
@@ -212,6 +217,8 @@ main(int argc, char *argv[]) {
 
   Game *game = new Game(map_generator);
   game->init();
+  game->enable_profiler(profile);
+  game->enable_serf_profiler(profile);
 
   /* Either load a save game if specified or
      start a new game. */
@@ -246,6 +246,8 @@ GameInitBox::handle_action(int action) {
       Game *old_game = interface->get_game();
       if (old_game != NULL) {
         EventLoop::get_instance()->del_handler(old_game);
+        game->enable_profiler(old_game->get_profiler() != NULL);
+        game->enable_serf_profiler(old_game->get_serf_profiler() != NULL);
       }
 
       EventLoop::get_instance()->add_handler(game);
@@ -42,19 +42,129 @@
 
 #define GROUND_ANALYSIS_RADIUS  25
 
+TimerWheel::TimerWheel() {
+  current = 0;
+  count = 0;
+}
+
+/* Remove all timers and continue from the given tick. */
+void
+TimerWheel::reset(unsigned int tick) {
+  for (int i = 0; i < TIMER_WHEEL_LEVELS; i++) {
+    for (int j = 0; j < TIMER_WHEEL_SLOTS; j++) {
+      slots[i][j].clear();
+    }
+  }
+  current = tick;
+  count = 0;
+}
+
+void
+TimerWheel::insert(const Timer &timer) {
+  unsigned int tick = timer.tick;
+  int level = 0;
+  while (level < TIMER_WHEEL_LEVELS - 1 &&
+         tick - current >= 1u << (TIMER_WHEEL_BITS * (level + 1))) {
+    level += 1;
+  }
+
+  unsigned int range = 1u << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+  if (tick - current >= range) tick = current + range - 1;
+
+  unsigned int slot = (tick >> (TIMER_WHEEL_BITS * level)) &
+                      (TIMER_WHEEL_SLOTS - 1);
+  slots[level][slot].push_back(timer);
+}
+
+void
+TimerWheel::schedule(unsigned int tick, unsigned int id, uint32_t data) {
+  /* Timers that are already due fire on the next tick. */
+  if (static_cast<int>(tick - current) <= 0) tick = current + 1;
+
+  Timer timer = { tick, id, data };
+  insert(timer);
+  count += 1;
+}
+
+/* Move the wheel forward to the given tick and append the timers that
+   have expired on the way to expired. */
+void
+TimerWheel::advance(unsigned int tick, std::vector<Timer> *expired) {
+  while (static_cast<int>(tick - current) > 0) {
+    if (count == 0) {
+      current = tick;
+      break;
+    }
+
+    current += 1;
+
+    /* Move the timers of the slots reached in the higher levels down,
+       starting from the highest level. */
+    int levels = 1;
+    while (levels < TIMER_WHEEL_LEVELS &&
+           ((current >> (TIMER_WHEEL_BITS * (levels - 1))) &
+            (TIMER_WHEEL_SLOTS - 1)) == 0) {
+      levels += 1;
+    }
+
+    for (int level = levels - 1; level > 0; level--) {
+      unsigned int slot = (current >> (TIMER_WHEEL_BITS * level)) &
+                          (TIMER_WHEEL_SLOTS - 1);
+      std::vector<Timer> timers;
+      timers.swap(slots[level][slot]);
+      for (size_t i = 0; i < timers.size(); i++) {
+        insert(timers[i]);
+      }
+    }
+
+    std::vector<Timer> &due = slots[0][current & (TIMER_WHEEL_SLOTS - 1)];
+    expired->insert(expired->end(), due.begin(), due.end());
+    count -= due.size();
+    due.clear();
+  }
+}
+
 Game::Game(int map_generator)
   : players(this)
   , flags(this)
   , inventories(this)
   , buildings(this)
-  , serfs(this) {
+  , serfs(this)
+  , flag_routes(this) {
   map = NULL;
+  resource_demand_valid = false;
+  stock_parking_counter = 0;
+  serf_update_tick = 0;
+  for (int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) {
+    build_possibilities_castle[i] = false;
+    std::fill(building_priorities[i],
+              building_priorities[i] + BUILDING_PRIORITY_SETTINGS, 0);
+  }
+  profiler = NULL;
+  serf_profiler = NULL;
   this->map_generator = map_generator;
+  for (int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) {
+    flag_network_epoch[i] = 1;
+    road_network_epoch[i] = 1;
+    inventory_epoch[i] = 1;
+  }
   allocate_objects();
 }
 
 Game::~Game() {
   deinit();
+
+  if (profiler != NULL) {
+    profiler->dump();
+    delete profiler;
+    profiler = NULL;
+  }
+
+  if (serf_profiler != NULL) {
+    serf_profiler->dump();
+    delete serf_profiler;
+    serf_profiler = NULL;
+  }
 }
 
 /* Clear the serf request bit of all flags and buildings.
@@ -81,30 +191,61 @@ Game::update_knight_morale() {
   }
 }
 
+/* Maximum number of resources moved out of inventories by
+   update_inventories(). */
+#define UPDATE_INVENTORIES_MAX_TYPES  12
+
+/* Search from the inventories of one player for the destinations of
+   several resources at once. Each inventory claims the flags that are
+   closer to it than to the other inventories, so the flags claimed do
+   not depend on the resource. */
 typedef struct UpdateInventoriesData {
-  Resource::Type resource;
-  int *max_prio;
-  Flag **flags;
+  std::vector<Inventory*> sources;
+  int types;
+  Resource::Type resource[UPDATE_INVENTORIES_MAX_TYPES];
+  std::vector<int> max_prio;
+  std::vector<Flag*> flags;
+  int remaining;
 } UpdateInventoriesData;
 
 bool
 Game::update_inventories_cb(Flag *flag, void *d) {
   UpdateInventoriesData *data =
                                 reinterpret_cast<UpdateInventoriesData*>(d);
+  if (!flag->has_building()) return false;
+
   int inv = flag->get_search_dir();
-  if (data->max_prio[inv] < 255 && flag->has_building()) {
-    Building *building = flag->get_building();
+  int n = static_cast<int>(data->sources.size());
+  Building *building = flag->get_building();
+  bool requested = false;
+  for (int t = 0; t < data->types; t++) {
+    int bld_prio = building->get_max_priority_for_resource(data->resource[t],
+                                                           16);
+    if (bld_prio < 0) continue;
 
-    int bld_prio = building->get_max_priority_for_resource(data->resource, 16);
-    if (bld_prio > data->max_prio[inv]) {
-      data->max_prio[inv] = bld_prio;
-      data->flags[inv] = flag;
+    requested = true;
+    int i = t*n + inv;
+    if (data->max_prio[i] < 255 && bld_prio > data->max_prio[i]) {
+      data->max_prio[i] = bld_prio;
+      data->flags[i] = flag;
     }
   }
 
+  /* Stop when every requesting building has been seen. */
+  if (requested) {
+    data->remaining -= 1;
+    if (data->remaining == 0) return true;
+  }
+
   return false;
 }
 
+/* Return whether building requests resource in one of its stocks. */
+static bool
+update_inventories_requests(Building *building, Resource::Type resource) {
+  return building->get_max_priority_for_resource(resource, 16) >= 0;
+}
+
 /* Update inventories as part of the game progression. Moves the appropriate
    resources that are needed outside of the inventory into the out queue. */
 void
@@ -166,29 +307,50 @@ Game::update_inventories() {
     default: arr = arr_1; break;
   }
 
-  while (arr[0] != Resource::TypeNone) {
+  /* Priorities of a resource are only changed when the resource itself
+     is assigned below, so the requested resources can be found up
+     front and a search can be skipped when nothing requests the
+     resource. */
+  unsigned int requested[GAME_MAX_PLAYER_COUNT] = { 0 };
+  for (Players::Iterator it = players.begin(); it != players.end(); ++it) {
+    unsigned int index = (*it)->get_index();
+    ViewBuildings view = buildings.get_view(player_buildings[index]);
+    for (ViewBuildings::Iterator i = view.begin(); i != view.end(); ++i) {
+      for (int k = 0; arr[k] != Resource::TypeNone; k++) {
+        if (update_inventories_requests(*i, arr[k])) {
+          requested[index] |= BIT(k);
+        }
+      }
+    }
+  }
+
+  /* The result of the search for the remaining resources, by player. It
+     can be used for a later resource as long as the same inventories
+     take part in the search. */
+  UpdateInventoriesData data[GAME_MAX_PLAYER_COUNT];
+  for (int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) data[i].types = 0;
+
+  for (int k = 0; arr[k] != Resource::TypeNone; k++) {
     for (Players::Iterator it = players.begin(); it != players.end(); ++it) {
-      Inventory *invs[256];
-      int n = 0;
-      for (Inventories::Iterator i = inventories.begin();
-           i != inventories.end(); ++i) {
+      Player *player = *it;
+      unsigned int index = player->get_index();
+      std::vector<Inventory*> invs;
+      ViewInventories view = inventories.get_view(player_inventories[index]);
+      for (ViewInventories::Iterator i = view.begin(); i != view.end(); ++i) {
         Inventory *inventory = *i;
-        if (inventory->get_owner() == (*it)->get_index() &&
-            !inventory->is_queue_full()) {
+        if (!inventory->is_queue_full()) {
           Inventory::Mode res_dir = inventory->get_res_mode();
           if (res_dir == Inventory::ModeIn || res_dir == Inventory::ModeStop) {
-            if (arr[0] == Resource::GroupFood) {
+            if (arr[k] == Resource::GroupFood) {
               if (inventory->has_food()) {
-                invs[n++] = inventory;
-                if (n == 256) break;
+                invs.push_back(inventory);
+                if (invs.size() == 256) break;
               }
-            } else if (inventory->get_count_of(arr[0]) != 0) {
-              invs[n++] = inventory;
-              if (n == 256) break;
+            } else if (inventory->get_count_of(arr[k]) != 0) {
+              invs.push_back(inventory);
+              if (invs.size() == 256) break;
             }
           } else { /* Out mode */
-            Player *player = *it;
-
             int prio = 0;
             Resource::Type type = Resource::TypeNone;
             for (int i = 0; i < 26; i++) {
@@ -206,33 +368,54 @@ Game::update_inventories() {
         }
       }
 
-      if (n == 0) continue;
+      if (invs.empty() || !(requested[index] & BIT(k))) continue;
 
-      FlagSearch search(this);
+      UpdateInventoriesData *search_data = &data[index];
+      if (search_data->types == 0 || search_data->sources != invs) {
+        search_data->sources = invs;
+        search_data->types = 0;
+        for (int j = k; arr[j] != Resource::TypeNone; j++) {
+          if (requested[index] & BIT(j)) {
+            search_data->resource[search_data->types++] = arr[j];
+          }
+        }
 
-      int max_prio[256];
-      Flag *flags_[256];
+        int n = static_cast<int>(invs.size());
+        search_data->max_prio.assign(search_data->types*n, 0);
+        search_data->flags.assign(search_data->types*n, NULL);
+
+        search_data->remaining = 0;
+        ViewBuildings bld_view = buildings.get_view(player_buildings[index]);
+        for (ViewBuildings::Iterator i = bld_view.begin();
+             i != bld_view.end(); ++i) {
+          for (int t = 0; t < search_data->types; t++) {
+            if (update_inventories_requests(*i, search_data->resource[t])) {
+              search_data->remaining += 1;
+              break;
+            }
+          }
+        }
 
-      for (int i = 0; i < n; i++) {
-        max_prio[i] = 0;
-        flags_[i] = NULL;
-        Flag *flag = flags[invs[i]->get_flag_index()];
-        flag->set_search_dir((Direction)i);
-        search.add_source(flag);
+        FlagSearch search(this);
+        for (int i = 0; i < n; i++) {
+          Flag *flag = flags[invs[i]->get_flag_index()];
+          flag->set_search_dir((Direction)i);
+          search.add_source(flag);
+        }
+
+        search.execute(update_inventories_cb, false, true, search_data);
       }
 
-      UpdateInventoriesData data;
-      data.resource = arr[0];
-      data.max_prio = max_prio;
-      data.flags = flags_;
-      search.execute(update_inventories_cb, false, true, &data);
+      int t = 0;
+      while (search_data->resource[t] != arr[k]) t += 1;
 
+      int n = static_cast<int>(invs.size());
       for (int i = 0; i < n; i++) {
-        if (max_prio[i] > 0) {
+        if (search_data->max_prio[t*n + i] > 0) {
           Log::Verbose["game"] << " dest for inventory " << i << "found";
-          Resource::Type res = (Resource::Type)arr[0];
+          Resource::Type res = (Resource::Type)arr[k];
 
-          Building *dest_bld = flags_[i]->get_building();
+          Building *dest_bld = search_data->flags[t*n + i]->get_building();
           bool r = dest_bld->add_requested_resource(res, false);
           assert(r);
 
@@ -242,17 +425,65 @@ Game::update_inventories() {
         }
       }
     }
-    arr += 1;
   }
 }
 
 /* Update flags as part of the game progression. */
 void
 Game::update_flags() {
-  for (Flags::Iterator i = flags.begin(); i != flags.end(); ++i) {
-    Flag *flag = *i;
+  collect_resource_demand();
+
+  unsigned int i = flags.next_excluding(0, idle_flags);
+  while (i != UINT_MAX) {
+    Flag *flag = flags[i];
     flag->update();
+    if (flag->is_idle()) idle_flags.insert(i);
+    i = flags.next_excluding(i + 1, idle_flags);
   }
+
+  resource_demand_valid = false;
+}
+
+/* Collect the flags of buildings with a non-zero priority for a
+   resource. Priorities are only lowered while flags are updated, so
+   searches for destinations of resources can stop once every
+   requesting building has been seen. */
+void
+Game::collect_resource_demand() {
+  for (int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) {
+    for (int j = 0; j < GAME_RESOURCE_DEMAND_TYPES; j++) {
+      resource_demand[i][j].clear();
+    }
+
+    ViewBuildings view = buildings.get_view(player_buildings[i]);
+    for (ViewBuildings::Iterator it = view.begin(); it != view.end(); ++it) {
+      Building *building = *it;
+      for (int k = 0; k < BUILDING_MAX_STOCK; k++) {
+        Resource::Type type = building->get_res_type_in_stock(k);
+        if (type < 0 || type >= GAME_RESOURCE_DEMAND_TYPES ||
+            building->get_priority_in_stock(k) <= 0) {
+          continue;
+        }
+
+        std::vector<unsigned int> &demand = resource_demand[i][type];
+        if (demand.empty() || demand.back() != building->get_flag_index()) {
+          demand.push_back(building->get_flag_index());
+        }
+      }
+    }
+  }
+
+  resource_demand_valid = true;
+}
+
+const std::vector<unsigned int> *
+Game::get_resource_demand(unsigned int player, Resource::Type res) {
+  if (!resource_demand_valid || res < 0 ||
+      res >= GAME_RESOURCE_DEMAND_TYPES) {
+    return NULL;
+  }
+
+  return &resource_demand[player][res];
 }
 
 typedef struct SendSerfToFlagData {
@@ -360,6 +591,12 @@ Game::send_serf_to_flag(Flag *dest, Serf::Type type, Resource::Type res1,
     type = player->get_cycling_sert_type(type);
   }
 
+  /* The search can only succeed after the flag network or the
+     inventories of the player have changed since it last failed. */
+  int key = (((type + 8) * 32 + (res1 + 1)) * 32 + (res2 + 1)) *
+            GAME_MAX_PLAYER_COUNT + dest->get_owner();
+  if (dest->is_serf_search_failed(key)) return true;
+
   SendSerfToFlagData data;
   data.inventory = NULL;
   data.building = building;
@@ -371,6 +608,7 @@ Game::send_serf_to_flag(Flag *dest, Serf::Type type, Resource::Type res1,
   bool r = FlagSearch::single(dest, send_serf_to_flag_search_cb, true, false,
                               &data);
   if (!r) {
+    dest->set_serf_search_failed(key);
     return true;
   } else if (data.inventory != NULL) {
     Inventory *inventory = data.inventory;
@@ -421,20 +659,197 @@ Game::send_geologist(Flag *dest) {
 /* Update buildings as part of the game progression. */
 void
 Game::update_buildings() {
-  Buildings::Iterator i = buildings.begin();
-  while (i != buildings.end()) {
-    Building *building = *i;
-    ++i;
-    building->update(tick);
+  wake_buildings_on_priority_change();
+
+  unsigned int i = buildings.next_excluding(0, settled_buildings);
+  while (i != UINT_MAX) {
+    buildings[i]->update(tick);
+    if (buildings.exists(i) && buildings[i]->is_settled()) {
+      settled_buildings.insert(i);
+    }
+    i = buildings.next_excluding(i + 1, settled_buildings);
+  }
+}
+
+/* Settled buildings have set their stock priorities from the
+   distribution priorities of their owner, so they are updated again
+   when those change. */
+void
+Game::wake_buildings_on_priority_change() {
+  for (Players::Iterator it = players.begin(); it != players.end(); ++it) {
+    Player *player = *it;
+    int values[BUILDING_PRIORITY_SETTINGS] = {
+      player->get_food_stonemine(), player->get_food_coalmine(),
+      player->get_food_ironmine(), player->get_food_goldmine(),
+      player->get_planks_construction(), player->get_planks_boatbuilder(),
+      player->get_planks_toolmaker(), player->get_steel_toolmaker(),
+      player->get_steel_weaponsmith(), player->get_coal_steelsmelter(),
+      player->get_coal_goldsmelter(), player->get_coal_weaponsmith(),
+      player->get_wheat_pigfarm(), player->get_wheat_mill()
+    };
+
+    int *last = building_priorities[player->get_index()];
+    if (std::equal(values, values + BUILDING_PRIORITY_SETTINGS, last)) {
+      continue;
+    }
+    std::copy(values, values + BUILDING_PRIORITY_SETTINGS, last);
+
+    ViewBuildings view = get_player_buildings(player);
+    for (ViewBuildings::Iterator i = view.begin(); i != view.end(); ++i) {
+      settled_buildings.erase((*i)->get_index());
+    }
   }
 }
 
 /* Update serfs as part of the game progression. */
 void
 Game::update_serfs() {
-  for (Serfs::Iterator i = serfs.begin(); i != serfs.end(); ++i) {
-    Serf *serf = *i;
+  serf_update_tick = tick;
+  wake_stock_timers();
+
+  if (serf_profiler != NULL) {
+    update_serfs_profiled();
+  } else {
+    unsigned int i = serfs.next_excluding(0, parked_serfs);
+    while (i != UINT_MAX) {
+      serfs[i]->update();
+      i = serfs.next_excluding(i + 1, parked_serfs);
+    }
+  }
+
+  park_stock_serfs();
+}
+
+/* Same as update_serfs() but records the time spent in each state. */
+void
+Game::update_serfs_profiled() {
+  serf_profiler->begin_update();
+
+  unsigned int i = serfs.next_excluding(0, parked_serfs);
+  while (i != UINT_MAX) {
+    Serf *serf = serfs[i];
+    Serf::State state = serf->get_state();
+    uint64_t start = TickProfiler::get_time_nsec();
     serf->update();
+    serf_profiler->record(state, TickProfiler::get_time_nsec() - start);
+    i = serfs.next_excluding(i + 1, parked_serfs);
+  }
+
+  serf_profiler->end_update();
+}
+
+/* Wake the inventories with knights whose training counter runs out. */
+void
+Game::wake_stock_timers() {
+  std::vector<TimerWheel::Timer> expired;
+  stock_timers.advance(tick, &expired);
+  for (size_t i = 0; i < expired.size(); i++) {
+    unsigned int inventory = expired[i].id;
+    if (inventory < stock_parked.size() &&
+        stock_parked[inventory] == expired[i].data) {
+      wake_stock_serfs(inventory);
+    }
+  }
+}
+
+/* Park the idle serfs of inventories where updating them would change
+   nothing. An idle serf in an inventory that is not sending out serfs
+   only registers itself as the serf of its type in the inventory, and
+   knights below the highest level train. So when the registered serf
+   of each type is the one a full round of updates would leave (the
+   idle serf of that type with the highest index), the serfs are
+   skipped until something changes in the inventory, see
+   wake_stock_serfs(), or a knight's training counter runs out. */
+void
+Game::park_stock_serfs() {
+  unsigned int index = awake_stocks.next(0);
+  while (index != UINT_MAX) {
+    unsigned int next = awake_stocks.next(index + 1);
+
+    Inventory *inventory = inventories[index];
+    if (inventory == NULL || index >= inventory_serfs.size() ||
+        inventory_serfs[index].size() == 0) {
+      awake_stocks.erase(index);
+      index = next;
+      continue;
+    }
+
+    Inventory::Mode mode = inventory->get_serf_mode();
+    bool passive = (mode == Inventory::ModeIn || mode == Inventory::ModeStop);
+
+    unsigned int wake_tick = UINT_MAX;
+    unsigned int last[Serf::TypeDead + 1];
+    bool found[Serf::TypeDead + 1] = { false };
+    ViewSerfs view = serfs.get_view(inventory_serfs[index]);
+    for (ViewSerfs::Iterator i = view.begin();
+         passive && i != view.end(); ++i) {
+      Serf *serf = *i;
+      unsigned int serf_wake_tick = 0;
+      if (!serf->get_idle_in_stock_wake_tick(&serf_wake_tick)) {
+        passive = false;
+        break;
+      }
+      wake_tick = std::min(wake_tick, serf_wake_tick);
+
+      Serf::Type type = serf->get_type();
+      if (type != Serf::TypeSmelter) {
+        last[type] = serf->get_index();
+        found[type] = true;
+      }
+    }
+
+    for (int t = 0; passive && t <= Serf::TypeDead; t++) {
+      if (found[t] &&
+          inventory->get_registered_serf((Serf::Type)t) != last[t]) {
+        passive = false;
+      }
+    }
+
+    if (passive) {
+      for (ViewSerfs::Iterator i = view.begin(); i != view.end(); ++i) {
+        parked_serfs.insert((*i)->get_index());
+      }
+
+      stock_parking_counter += 1;
+      if (stock_parking_counter == 0) stock_parking_counter = 1;
+      if (index >= stock_parked.size()) stock_parked.resize(index + 1, 0);
+      stock_parked[index] = stock_parking_counter;
+      awake_stocks.erase(index);
+
+      if (wake_tick != UINT_MAX) {
+        stock_timers.schedule(wake_tick, index, stock_parking_counter);
+      }
+    }
+
+    index = next;
+  }
+}
+
+/* Resume updates of the idle serfs of an inventory, because something
+   changed that they may react to. */
+void
+Game::wake_stock_serfs(unsigned int inventory) {
+  if (inventory < stock_parked.size() && stock_parked[inventory] != 0) {
+    stock_parked[inventory] = 0;
+    ViewSerfs view = serfs.get_view(inventory_serfs[inventory]);
+    for (ViewSerfs::Iterator i = view.begin(); i != view.end(); ++i) {
+      Serf *serf = *i;
+      serf->catch_up_idle_in_stock(serf_update_tick);
+      parked_serfs.erase(serf->get_index());
+    }
+  }
+
+  awake_stocks.insert(inventory);
+}
+
+/* Bring the parked serfs up to date as if they had been updated, e.g.
+   before the game is saved. */
+void
+Game::update_parked_serfs() {
+  unsigned int i = parked_serfs.next(0);
+  while (i != UINT_MAX) {
+    serfs[i]->catch_up_idle_in_stock(serf_update_tick);
+    i = parked_serfs.next(i + 1);
   }
 }
 
@@ -587,13 +1002,17 @@ Game::update() {
   tick += game_speed;
   tick_diff = tick - last_tick;
 
+  TickProfiler::Timer timer(profiler);
+
   clear_serf_request_failure();
   map->update(tick, &init_map_rnd);
+  timer.lap(TickProfiler::PhaseMap);
 
   /* Update players */
   for (Players::Iterator it = players.begin(); it != players.end(); ++it) {
     (*it)->update();
   }
+  timer.lap(TickProfiler::PhasePlayers);
 
   /* Update knight morale */
   knight_morale_counter -= tick_diff;
@@ -601,6 +1020,7 @@ Game::update() {
     update_knight_morale();
     knight_morale_counter += 256;
   }
+  timer.lap(TickProfiler::PhaseKnightMorale);
 
   /* Schedule resources to go out of inventories */
   inventory_schedule_counter -= tick_diff;
@@ -608,6 +1028,7 @@ Game::update() {
     update_inventories();
     inventory_schedule_counter += 64;
   }
+  timer.lap(TickProfiler::PhaseInventories);
 
 #if 0
   /* AI related updates */
@@ -633,9 +1054,37 @@ Game::update() {
 #endif
 
   update_flags();
+  timer.lap(TickProfiler::PhaseFlags);
   update_buildings();
+  timer.lap(TickProfiler::PhaseBuildings);
   update_serfs();
+  timer.lap(TickProfiler::PhaseSerfs);
   update_game_stats();
+  timer.lap(TickProfiler::PhaseGameStats);
+  timer.finish();
+}
+
+/* Enable or disable timing of the update phases. When disabled
+   the collected statistics are discarded. */
+void
+Game::enable_profiler(bool enable) {
+  if (enable && profiler == NULL) {
+    profiler = new TickProfiler();
+  } else if (!enable && profiler != NULL) {
+    delete profiler;
+    profiler = NULL;
+  }
+}
+
+/* Enable or disable timing of Serf::update() for each serf state. */
+void
+Game::enable_serf_profiler(bool enable) {
+  if (enable && serf_profiler == NULL) {
+    serf_profiler = new SerfStateProfiler();
+  } else if (!enable && serf_profiler != NULL) {
+    delete serf_profiler;
+    serf_profiler = NULL;
+  }
 }
 
 /* Pause or unpause the game. */
@@ -1316,6 +1765,114 @@ Game::can_player_build(MapPos pos, const Player *player) {
   return true;
 }
 
+/* Find what player can build at position. */
+Game::BuildPossibility
+Game::find_build_possibility(MapPos pos, const Player *player) {
+  MapPos flag_pos = map->move_down_right(pos);
+  if (can_build_castle(pos, player)) {
+    return BuildPossibilityCastle;
+  } else if (can_player_build(pos, player) &&
+             Map::map_space_from_obj[map->get_obj(pos)] == Map::SpaceOpen &&
+             (can_build_flag(flag_pos, player) || map->has_flag(flag_pos))) {
+    if (can_build_mine(pos)) {
+      return BuildPossibilityMine;
+    } else if (can_build_large(pos)) {
+      return BuildPossibilityLarge;
+    } else if (can_build_small(pos)) {
+      return BuildPossibilitySmall;
+    } else if (can_build_flag(pos, player)) {
+      return BuildPossibilityFlag;
+    }
+  } else if (can_build_flag(pos, player)) {
+    return BuildPossibilityFlag;
+  }
+
+  return BuildPossibilityNone;
+}
+
+/* Return what player can build at position. The result is kept until
+   the map near the position changes. */
+Game::BuildPossibility
+Game::get_build_possibility(MapPos pos, const Player *player) {
+  unsigned int index = player->get_index();
+  std::vector<uint8_t> &possibilities = build_possibilities[index];
+  if (possibilities.empty() ||
+      build_possibilities_castle[index] != player->has_castle()) {
+    possibilities.assign(map->get_cols() * map->get_rows(),
+                         BUILD_POSSIBILITY_UNKNOWN);
+    build_possibility_squares[index].assign(
+      possibilities.size() >> (2*BUILD_POSSIBILITY_SQUARE_SHIFT), false);
+    build_possibilities_castle[index] = player->has_castle();
+  }
+
+  if (possibilities[pos] == BUILD_POSSIBILITY_UNKNOWN) {
+    possibilities[pos] = find_build_possibility(pos, player);
+    build_possibility_squares[index][get_build_possibility_square(pos)] =
+      true;
+  }
+
+  return static_cast<BuildPossibility>(possibilities[pos]);
+}
+
+/* Forget what can be built at the positions that depend on the map at
+   pos, i.e. those within reach of the checks in find_build_possibility()
+   from a neighbour of pos. Whole squares are forgotten, so squares that
+   have no known possibilities left can be skipped. */
+void
+Game::invalidate_build_possibilities(MapPos pos) {
+  int radius = Map::get_spiral_radius(1+6+12+18-1) + 1;
+  int cols = map->get_cols();
+  int rows = map->get_rows();
+  int square_cols = cols >> BUILD_POSSIBILITY_SQUARE_SHIFT;
+  int square_rows = rows >> BUILD_POSSIBILITY_SQUARE_SHIFT;
+  int square_size = 1 << BUILD_POSSIBILITY_SQUARE_SHIFT;
+
+  /* Squares from the first to the last one that the area overlaps. */
+  int first_col = (map->pos_col(pos) - radius + cols) >>
+                  BUILD_POSSIBILITY_SQUARE_SHIFT;
+  int last_col = (map->pos_col(pos) + radius + cols) >>
+                 BUILD_POSSIBILITY_SQUARE_SHIFT;
+  int first_row = (map->pos_row(pos) - radius + rows) >>
+                  BUILD_POSSIBILITY_SQUARE_SHIFT;
+  int last_row = (map->pos_row(pos) + radius + rows) >>
+                 BUILD_POSSIBILITY_SQUARE_SHIFT;
+
+  for (int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) {
+    std::vector<uint8_t> &possibilities = build_possibilities[i];
+    std::vector<bool> &squares = build_possibility_squares[i];
+    if (possibilities.empty()) continue;
+
+    for (int r = first_row; r <= last_row; r++) {
+      int square_row = r % square_rows;
+      for (int c = first_col; c <= last_col; c++) {
+        int square_col = c % square_cols;
+        int square = square_row*square_cols + square_col;
+        if (!squares[square]) continue;
+
+        squares[square] = false;
+        for (int y = 0; y < square_size; y++) {
+          MapPos p = map->pos(square_col << BUILD_POSSIBILITY_SQUARE_SHIFT,
+                              (square_row << BUILD_POSSIBILITY_SQUARE_SHIFT) +
+                              y);
+          std::fill(possibilities.begin() + p,
+                    possibilities.begin() + p + square_size,
+                    BUILD_POSSIBILITY_UNKNOWN);
+        }
+      }
+    }
+  }
+}
+
+void
+Game::on_height_changed(MapPos pos) {
+  invalidate_build_possibilities(pos);
+}
+
+void
+Game::on_object_changed(MapPos pos) {
+  invalidate_build_possibilities(pos);
+}
+
 /* Checks whether a building of the specified type is possible at
    position. */
 bool
@@ -1413,6 +1970,8 @@ Game::build_building(MapPos pos, Building::Type type, Player *player) {
   bld->set_level(get_leveling_height(pos));
   bld->set_position(pos);
   Map::Object map_obj = bld->start_building(type);
+  if (bld->is_military()) military_buildings.insert(bld->get_index());
+  link_building_pos(bld);
   player->building_founded(bld);
 
   bool split_path = false;
@@ -1489,6 +2048,8 @@ Game::build_castle(MapPos pos, Player *player) {
   flag->set_position(map->move_down_right(pos));
   castle->set_owner(player->get_index());
   castle->start_building(Building::TypeCastle);
+  military_buildings.insert(castle->get_index());
+  link_building_pos(castle);
 
   flag->set_owner(player->get_index());
   flag->set_accepts_serfs(true);
@@ -1592,6 +2153,8 @@ Game::demolish_flag_(MapPos pos) {
   /* Remove resources from flag. */
   flag->remove_all_resources();
 
+  road_network_changed(flag->get_owner());
+  idle_flags.erase(flag->get_index());
   flags.erase(flag->get_index());
 
   return true;
@@ -1658,7 +2221,7 @@ Game::demolish_building_(MapPos pos) {
       map->add_gold_deposit(-static_cast< int >(
                            inventory->get_count_of(Resource::TypeGoldOre)));
 
-      inventories.erase(inventory->get_index());
+      delete_inventory(inventory);
     }
 
     /* Let some serfs escape while the building is burning. */
@@ -1820,48 +2383,147 @@ Game::init_land_ownership() {
   }
 }
 
-/* Update land ownership around map position. */
+/* Military influence of huts, towers and fortresses (including the
+   castle) by closeness to the building. Influence -1 makes the land
+   belong to the building regardless of other buildings. */
+static const int military_influence[] = {
+  0, 1, 2, 4, 7, 12, 18, 29, -1, -1,  /* hut */
+  0, 3, 5, 8, 11, 15, 22, 30, -1, -1,  /* tower */
+  0, 6, 10, 14, 19, 23, 27, 31, -1, -1  /* fortress */
+};
+
+/* Closeness of the positions in the square around a military building. */
+static const int map_closeness[] = {
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0,
+  1, 2, 2, 2, 2, 2, 2, 2, 2, 1, 0, 0, 0, 0, 0, 0, 0,
+  1, 2, 3, 3, 3, 3, 3, 3, 3, 2, 1, 0, 0, 0, 0, 0, 0,
+  1, 2, 3, 4, 4, 4, 4, 4, 4, 3, 2, 1, 0, 0, 0, 0, 0,
+  1, 2, 3, 4, 5, 5, 5, 5, 5, 4, 3, 2, 1, 0, 0, 0, 0,
+  1, 2, 3, 4, 5, 6, 6, 6, 6, 5, 4, 3, 2, 1, 0, 0, 0,
+  1, 2, 3, 4, 5, 6, 7, 7, 7, 6, 5, 4, 3, 2, 1, 0, 0,
+  1, 2, 3, 4, 5, 6, 7, 8, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+  1, 2, 3, 4, 5, 6, 7, 8, 9, 8, 7, 6, 5, 4, 3, 2, 1,
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 7, 6, 5, 4, 3, 2, 1,
+  0, 0, 1, 2, 3, 4, 5, 6, 7, 7, 7, 6, 5, 4, 3, 2, 1,
+  0, 0, 0, 1, 2, 3, 4, 5, 6, 6, 6, 6, 5, 4, 3, 2, 1,
+  0, 0, 0, 0, 1, 2, 3, 4, 5, 5, 5, 5, 5, 4, 3, 2, 1,
+  0, 0, 0, 0, 0, 1, 2, 3, 4, 4, 4, 4, 4, 4, 3, 2, 1,
+  0, 0, 0, 0, 0, 0, 1, 2, 3, 3, 3, 3, 3, 3, 3, 2, 1,
+  0, 0, 0, 0, 0, 0, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2, 1,
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1
+};
+
+/* Return the row of military_influence that applies to the building, or
+   -1 if the building has no influence on land ownership. */
+int
+Game::get_military_influence_type(Building *building) {
+  MapPos pos = building->get_position();
+  if (map->get_obj(pos) < Map::ObjectSmallBuilding ||
+      map->get_obj(pos) > Map::ObjectCastle ||
+      map->get_obj_index(pos) != building->get_index() ||
+      !BIT_TEST(map->paths(pos),
+                DirectionDownRight)) {  // TODO(_): Why wouldn't this be set?
+    return -1;
+  }
+
+  int mil_type = -1;
+  if (building->get_type() == Building::TypeCastle) {
+    /* Castle has military influence even when not done. */
+    mil_type = 2;
+  } else if (building->is_done() && building->is_active()) {
+    switch (building->get_type()) {
+      case Building::TypeHut: mil_type = 0; break;
+      case Building::TypeTower: mil_type = 1; break;
+      case Building::TypeFortress: mil_type = 2; break;
+      default: break;
+    }
+  }
+
+  if (building->is_burning()) return -1;
+
+  return mil_type;
+}
+
+/* Add (sign 1) or remove (sign -1) the influence of a building to the
+   influence map of its owner. The low 16 bits of each position hold the
+   sum of the influences, the high bits count the influences of -1. */
 void
-Game::update_land_ownership(MapPos init_pos) {
-  /* Currently the below algorithm will only work when
-     both influence_radius and calculate_radius are 8. */
-  const int influence_radius = 8;
-  const int influence_diameter = 1 + 2*influence_radius;
+Game::add_military_influence(const InfluenceSource &source, int sign) {
+  const int radius = MILITARY_INFLUENCE_RADIUS;
 
-  int calculate_radius = influence_radius;
-  int calculate_diameter = 1 + 2*calculate_radius;
+  std::vector<uint32_t> &influence_map = influence_maps[source.player];
+  if (influence_map.empty()) {
+    influence_map.resize(map->get_cols() * map->get_rows(), 0);
+  }
 
-  int *temp_arr = reinterpret_cast<int*>(calloc(GAME_MAX_PLAYER_COUNT*
-                                                calculate_diameter*
-                                                calculate_diameter,
-                                                sizeof(int)));
-  if (temp_arr == NULL) abort();
+  const int *influence = military_influence + 10*source.type;
+  const int *closeness = map_closeness;
+  for (int i = -radius; i <= radius; i++) {
+    for (int j = -radius; j <= radius; j++) {
+      int inf = influence[*closeness++];
+      if (inf == 0) continue;
 
-  const int military_influence[] = {
-    0, 1, 2, 4, 7, 12, 18, 29, -1, -1,  /* hut */
-    0, 3, 5, 8, 11, 15, 22, 30, -1, -1,  /* tower */
-    0, 6, 10, 14, 19, 23, 27, 31, -1, -1  /* fortress */
-  };
+      MapPos pos = map->pos_add(source.pos,
+                                map->pos(j & map->get_col_mask(),
+                                         i & map->get_row_mask()));
+      uint32_t value = (inf < 0) ? (1 << 16) : inf;
+      influence_map[pos] += (sign < 0) ? -value : value;
+    }
+  }
+}
 
-  const int map_closeness[] = {
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0,
-    1, 2, 2, 2, 2, 2, 2, 2, 2, 1, 0, 0, 0, 0, 0, 0, 0,
-    1, 2, 3, 3, 3, 3, 3, 3, 3, 2, 1, 0, 0, 0, 0, 0, 0,
-    1, 2, 3, 4, 4, 4, 4, 4, 4, 3, 2, 1, 0, 0, 0, 0, 0,
-    1, 2, 3, 4, 5, 5, 5, 5, 5, 4, 3, 2, 1, 0, 0, 0, 0,
-    1, 2, 3, 4, 5, 6, 6, 6, 6, 5, 4, 3, 2, 1, 0, 0, 0,
-    1, 2, 3, 4, 5, 6, 7, 7, 7, 6, 5, 4, 3, 2, 1, 0, 0,
-    1, 2, 3, 4, 5, 6, 7, 8, 8, 7, 6, 5, 4, 3, 2, 1, 0,
-    1, 2, 3, 4, 5, 6, 7, 8, 9, 8, 7, 6, 5, 4, 3, 2, 1,
-    0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 7, 6, 5, 4, 3, 2, 1,
-    0, 0, 1, 2, 3, 4, 5, 6, 7, 7, 7, 6, 5, 4, 3, 2, 1,
-    0, 0, 0, 1, 2, 3, 4, 5, 6, 6, 6, 6, 5, 4, 3, 2, 1,
-    0, 0, 0, 0, 1, 2, 3, 4, 5, 5, 5, 5, 5, 4, 3, 2, 1,
-    0, 0, 0, 0, 0, 1, 2, 3, 4, 4, 4, 4, 4, 4, 3, 2, 1,
-    0, 0, 0, 0, 0, 0, 1, 2, 3, 3, 3, 3, 3, 3, 3, 2, 1,
-    0, 0, 0, 0, 0, 0, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2, 1,
-    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1
-  };
+/* Bring the influence maps up to date with the military buildings as
+   they are now. Only the buildings whose influence has changed since the
+   last update are added again. */
+void
+Game::update_military_influence() {
+  ViewBuildings view = buildings.get_view(military_buildings);
+  for (ViewBuildings::Iterator i = view.begin(); i != view.end(); ++i) {
+    Building *building = *i;
+    unsigned int index = building->get_index();
+    InfluenceSource source;
+    source.pos = building->get_position();
+    source.player = building->get_owner();
+    source.type = get_military_influence_type(building);
+
+    if (influence_sources.size() <= index) {
+      InfluenceSource none = { 0, 0, -1 };
+      influence_sources.resize(index + 1, none);
+    }
+
+    InfluenceSource &old_source = influence_sources[index];
+    if (source.type < 0 && old_source.type < 0) continue;
+    if (source.type == old_source.type && source.pos == old_source.pos &&
+        source.player == old_source.player) {
+      continue;
+    }
+
+    if (old_source.type >= 0) add_military_influence(old_source, -1);
+    if (source.type >= 0) add_military_influence(source, 1);
+    old_source = source;
+  }
+}
+
+/* Influence of player on land ownership at pos, as it was at the last
+   call to update_military_influence(). */
+int
+Game::get_military_influence(unsigned int player, MapPos pos) {
+  if (influence_maps[player].empty()) return 0;
+
+  uint32_t value = influence_maps[player][pos];
+  if ((value >> 16) != 0) return 128;
+  return std::min(static_cast<int>(value), 127);
+}
+
+/* Find influence from buildings in 33*33 square around the center
+   by looking at each position of the square. */
+void
+Game::find_military_influence(MapPos init_pos, int *temp_arr) {
+  const int influence_radius = MILITARY_INFLUENCE_RADIUS;
+  const int influence_diameter = 1 + 2*influence_radius;
+
+  int calculate_radius = influence_radius;
+  int calculate_diameter = 1 + 2*calculate_radius;
 
   /* Find influence from buildings in 33*33 square
      around the center. */
@@ -1916,6 +2578,48 @@ Game::update_land_ownership(MapPos init_pos) {
       }
     }
   }
+}
+
+/* Update land ownership around map position. */
+void
+Game::update_land_ownership(MapPos init_pos) {
+  /* Currently the below algorithm will only work when
+     both influence_radius and calculate_radius are 8. */
+  const int influence_radius = MILITARY_INFLUENCE_RADIUS;
+
+  int calculate_radius = influence_radius;
+  int calculate_diameter = 1 + 2*calculate_radius;
+
+  int *temp_arr = reinterpret_cast<int*>(calloc(GAME_MAX_PLAYER_COUNT*
+                                                calculate_diameter*
+                                                calculate_diameter,
+                                                sizeof(int)));
+  if (temp_arr == NULL) abort();
+
+  const int scan_diameter = 1 + 2*(influence_radius+calculate_radius);
+  if (map->get_cols() >= static_cast<unsigned int>(scan_diameter) &&
+      map->get_rows() >= static_cast<unsigned int>(scan_diameter)) {
+    /* Take the influence from the influence maps. */
+    update_military_influence();
+
+    for (int i = -calculate_radius; i <= calculate_radius; i++) {
+      for (int j = -calculate_radius; j <= calculate_radius; j++) {
+        MapPos pos = map->pos_add(init_pos,
+                                  map->pos(j & map->get_col_mask(),
+                                           i & map->get_row_mask()));
+        for (int p = 0; p < GAME_MAX_PLAYER_COUNT; p++) {
+          temp_arr[p*calculate_diameter*calculate_diameter +
+                   calculate_diameter*(i+calculate_radius) +
+                   (j+calculate_radius)] = get_military_influence(p, pos);
+        }
+      }
+    }
+  } else {
+    /* On maps smaller than the 33*33 square the buildings around the
+       center are found more than once, which the influence maps cannot
+       reproduce. */
+    find_military_influence(init_pos, temp_arr);
+  }
 
   /* Update owner of 17*17 square. */
   for (int i = -calculate_radius; i <= calculate_radius; i++) {
@@ -1956,19 +2660,27 @@ Game::update_land_ownership(MapPos init_pos) {
 
   free(temp_arr);
 
-  /* Update military building flag state. */
-  for (int i = -25; i <= 25; i++) {
-    for (int j = -25; j <= 25; j++) {
-      MapPos pos = map->pos_add(init_pos, map->pos(i & map->get_col_mask(),
-                                                      j & map->get_row_mask()));
-
-      if (map->get_obj(pos) >= Map::ObjectSmallBuilding &&
-          map->get_obj(pos) <= Map::ObjectCastle &&
-          BIT_TEST(map->paths(pos), DirectionDownRight)) {
-        Building *building = buildings[map->get_obj_index(pos)];
-        if (building->is_done() && building->is_military()) {
-          calculate_military_flag_state(building);
-        }
+  /* Update military building flag state of buildings within 25
+     positions of the center. */
+  ViewBuildings view = buildings.get_view(military_buildings);
+  for (ViewBuildings::Iterator it = view.begin(); it != view.end(); ++it) {
+    Building *building = *it;
+    MapPos pos = building->get_position();
+    unsigned int col = (map->pos_col(pos) - map->pos_col(init_pos)) &
+                       map->get_col_mask();
+    unsigned int row = (map->pos_row(pos) - map->pos_row(init_pos)) &
+                       map->get_row_mask();
+    if ((col > 25 && col < map->get_cols() - 25) ||
+        (row > 25 && row < map->get_rows() - 25)) {
+      continue;
+    }
+
+    if (map->get_obj(pos) >= Map::ObjectSmallBuilding &&
+        map->get_obj(pos) <= Map::ObjectCastle &&
+        map->get_obj_index(pos) == building->get_index() &&
+        BIT_TEST(map->paths(pos), DirectionDownRight)) {
+      if (building->is_done() && building->is_military()) {
+        calculate_military_flag_state(building);
       }
     }
   }
@@ -2156,6 +2868,9 @@ Game::init_map(int size) {
 
   map = new Map();
   map->init(size);
+  map->add_change_handler(this);
+
+  rebuild_indexes();
 }
 
 void
@@ -2163,32 +2878,32 @@ Game::init_map_data(const MapGenerator& generator) {
   this->map->init_tiles(generator);
 }
 
+/* Log the number of objects of each kind, the most that have existed
+   at the same time and the storage reserved for them. */
 void
-Game::deinit() {
-  while (serfs.size()) {
-    Serfs::Iterator it = serfs.begin();
-    serfs.erase((*it)->get_index());
-  }
-
-  while (buildings.size()) {
-    Buildings::Iterator it = buildings.begin();
-    buildings.erase((*it)->get_index());
-  }
-
-  while (inventories.size()) {
-    Inventories::Iterator it = inventories.begin();
-    inventories.erase((*it)->get_index());
-  }
-
-  while (flags.size()) {
-    Flags::Iterator it = flags.begin();
-    flags.erase((*it)->get_index());
-  }
+Game::log_object_usage() {
+  Log::Info["game"] << "Serfs: " << serfs.size() << " (peak "
+                    << serfs.get_high_water_mark() << ", "
+                    << serfs.get_storage_size() / 1024 << " KiB)";
+  Log::Info["game"] << "Flags: " << flags.size() << " (peak "
+                    << flags.get_high_water_mark() << ", "
+                    << flags.get_storage_size() / 1024 << " KiB)";
+  Log::Info["game"] << "Buildings: " << buildings.size() << " (peak "
+                    << buildings.get_high_water_mark() << ", "
+                    << buildings.get_storage_size() / 1024 << " KiB)";
+  Log::Info["game"] << "Inventories: " << inventories.size() << " (peak "
+                    << inventories.get_high_water_mark() << ", "
+                    << inventories.get_storage_size() / 1024 << " KiB)";
+}
 
-  while (players.size()) {
-    Players::Iterator it = players.begin();
-    players.erase((*it)->get_index());
-  }
+void
+Game::deinit() {
+  clear_indexes();
+  serfs.clear();
+  buildings.clear();
+  inventories.clear();
+  flags.clear();
+  players.clear();
 
   if (map != NULL) {
     delete map;
@@ -2258,6 +2973,8 @@ bool
 Game::load_random_map(int size, const Random &rnd) {
   if (size < 3 || size > 10) return false;
 
+  deinit();
+
   init_map(size);
   {
     ClassicMapGenerator generator(*this->map, rnd);
@@ -2271,6 +2988,15 @@ Game::load_random_map(int size, const Random &rnd) {
   return true;
 }
 
+/* Derive the game and map update random states from a seed, so that
+   the game always plays out the same way from here. */
+void
+Game::seed_random(const Random &rnd) {
+  init_map_rnd = rnd;
+  this->rnd = rnd;
+  this->rnd ^= Random(0x5a5a, 0xa5a5, 0xc3c3);
+}
+
 bool
 Game::load_save_game(const std::string &path) {
   if (!load_state(path, this)) {
@@ -2321,7 +3047,9 @@ Game::handle_event(const Event *event) {
   return false;
 }
 
-int
+/* Return the id of a new flag search. The id is 32 bits wide, so the
+   flags only need to be reset after billions of searches. */
+unsigned int
 Game::next_search_id() {
   flag_search_counter += 1;
 
@@ -2335,6 +3063,28 @@ Game::next_search_id() {
   return flag_search_counter;
 }
 
+void
+Game::flag_network_changed(unsigned int player) {
+  flag_network_epoch[player] += 1;
+
+  /* Zero is never a valid epoch. */
+  if (flag_network_epoch[player] == 0) flag_network_epoch[player] = 1;
+}
+
+void
+Game::road_network_changed(unsigned int player) {
+  road_network_epoch[player] += 1;
+  if (road_network_epoch[player] == 0) road_network_epoch[player] = 1;
+
+  flag_network_changed(player);
+}
+
+void
+Game::inventory_gained(unsigned int player) {
+  inventory_epoch[player] += 1;
+  if (inventory_epoch[player] == 0) inventory_epoch[player] = 1;
+}
+
 Serf *
 Game::create_serf(int index) {
   if (index == -1) {
@@ -2346,7 +3096,16 @@ Game::create_serf(int index) {
 
 void
 Game::delete_serf(Serf *serf) {
-  serfs.erase(serf->get_index());
+  unsigned int index = serf->get_index();
+  if (serf->get_player() < GAME_MAX_PLAYER_COUNT) {
+    player_serfs[serf->get_player()].erase(index);
+  }
+  if (serf->get_state() == Serf::StateIdleInStock) {
+    serf_left_stock(serf);
+  }
+  unlink_serf_pos(index, serf->get_pos());
+
+  serfs.erase(index);
 }
 
 Flag *
@@ -2376,84 +3135,305 @@ Game::create_building(int index) {
   }
 }
 
+void
+Game::delete_inventory(Inventory *inventory) {
+  wake_stock_serfs(inventory->get_index());
+  player_inventories[inventory->get_owner()].erase(inventory->get_index());
+  inventories.erase(inventory->get_index());
+}
+
 void
 Game::delete_building(Building *building) {
   map->set_object(building->get_position(), Map::ObjectNone, 0);
+  player_buildings[building->get_owner()].erase(building->get_index());
+  settled_buildings.erase(building->get_index());
+  military_buildings.erase(building->get_index());
+  unlink_building_pos(building);
+  if (building->get_index() < influence_sources.size()) {
+    InfluenceSource &source = influence_sources[building->get_index()];
+    if (source.type >= 0) add_military_influence(source, -1);
+    source.type = -1;
+  }
   buildings.erase(building->get_index());
 }
 
-Game::ListSerfs
-Game::get_player_serfs(Player *player) {
-  ListSerfs player_serfs;
+/* The following keep the secondary indexes up to date. They are called
+   by the objects whenever the indexed properties change. */
 
-  for (Serfs::Iterator i = serfs.begin(); i != serfs.end(); ++i) {
-    Serf *serf = *i;
-    if (serf->get_player() == player->get_index()) {
-      player_serfs.push_back(serf);
-    }
+void
+Game::serf_owner_changed(Serf *serf, unsigned int old_owner) {
+  if (old_owner < GAME_MAX_PLAYER_COUNT) {
+    player_serfs[old_owner].erase(serf->get_index());
+  }
+  if (serf->get_player() < GAME_MAX_PLAYER_COUNT) {
+    player_serfs[serf->get_player()].insert(serf->get_index());
   }
+}
 
-  return player_serfs;
+void
+Game::serf_pos_changed(Serf *serf, MapPos old_pos) {
+  unlink_serf_pos(serf->get_index(), old_pos);
+  link_serf_pos(serf->get_index(), serf->get_pos());
 }
 
-Game::ListBuildings
-Game::get_player_buildings(Player *player) {
-  ListBuildings player_buildings;
+/* Serf has become idle in the inventory given by its state. */
+void
+Game::serf_entered_stock(Serf *serf) {
+  unsigned int index = serf->get_idle_in_stock_inv_index();
+  if (index >= inventory_serfs.size()) {
+    inventory_serfs.resize(index + 1);
+  }
+  wake_stock_serfs(index);
+  inventory_serfs[index].insert(serf->get_index());
+}
 
-  for (Buildings::Iterator i = buildings.begin(); i != buildings.end(); ++i) {
-    Building *building = *i;
-    if (building->get_owner() == player->get_index()) {
-      player_buildings.push_back(building);
-    }
+/* Serf is about to leave the idle in stock state. */
+void
+Game::serf_left_stock(Serf *serf) {
+  unsigned int index = serf->get_idle_in_stock_inv_index();
+  if (index < inventory_serfs.size()) {
+    wake_stock_serfs(index);
+    inventory_serfs[index].erase(serf->get_index());
   }
+}
 
-  return player_buildings;
+void
+Game::building_owner_changed(Building *building, unsigned int old_owner) {
+  player_buildings[old_owner].erase(building->get_index());
+  player_buildings[building->get_owner()].insert(building->get_index());
 }
 
-Game::ListInventories
-Game::get_player_inventories(Player *player) {
-  ListInventories player_inventories;
+void
+Game::inventory_owner_changed(Inventory *inventory, unsigned int old_owner) {
+  player_inventories[old_owner].erase(inventory->get_index());
+  player_inventories[inventory->get_owner()].insert(inventory->get_index());
+  inventory_gained(inventory->get_owner());
+}
+
+void
+Game::link_serf_pos(unsigned int index, MapPos pos) {
+  if (pos >= serf_pos_first.size()) return;
+
+  if (index >= serf_pos_next.size()) {
+    serf_pos_next.resize(index + 1, SERF_POS_LIST_END);
+    serf_pos_prev.resize(index + 1, SERF_POS_LIST_END);
+  }
+
+  unsigned int first = serf_pos_first[pos];
+  serf_pos_next[index] = first;
+  serf_pos_prev[index] = SERF_POS_LIST_END;
+  if (first != SERF_POS_LIST_END) serf_pos_prev[first] = index;
+  serf_pos_first[pos] = index;
+}
+
+void
+Game::unlink_serf_pos(unsigned int index, MapPos pos) {
+  if (pos >= serf_pos_first.size()) return;
+
+  unsigned int next = serf_pos_next[index];
+  unsigned int prev = serf_pos_prev[index];
+  if (prev == SERF_POS_LIST_END) {
+    serf_pos_first[pos] = next;
+  } else {
+    serf_pos_next[prev] = next;
+  }
+  if (next != SERF_POS_LIST_END) serf_pos_prev[next] = prev;
+}
+
+/* Index of the square of positions that pos is in. */
+size_t
+Game::get_building_bucket(MapPos pos) {
+  unsigned int cols = map->get_cols() >> BUILDING_BUCKET_SHIFT;
+  return (map->pos_row(pos) >> BUILDING_BUCKET_SHIFT) * cols +
+         (map->pos_col(pos) >> BUILDING_BUCKET_SHIFT);
+}
+
+/* Index of the square of build possibilities that pos is in. */
+size_t
+Game::get_build_possibility_square(MapPos pos) {
+  unsigned int cols = map->get_cols() >> BUILD_POSSIBILITY_SQUARE_SHIFT;
+  return (map->pos_row(pos) >> BUILD_POSSIBILITY_SQUARE_SHIFT) * cols +
+         (map->pos_col(pos) >> BUILD_POSSIBILITY_SQUARE_SHIFT);
+}
+
+void
+Game::link_building_pos(Building *building) {
+  if (building_buckets.empty()) return;
+  size_t bucket = get_building_bucket(building->get_position());
+  building_buckets[bucket].push_back(building->get_index());
+}
+
+void
+Game::unlink_building_pos(Building *building) {
+  if (building_buckets.empty()) return;
+  std::vector<unsigned int> &bucket =
+    building_buckets[get_building_bucket(building->get_position())];
+  std::vector<unsigned int>::iterator i = std::find(bucket.begin(),
+                                                    bucket.end(),
+                                                    building->get_index());
+  if (i != bucket.end()) bucket.erase(i);
+}
+
+void
+Game::clear_indexes() {
+  for (int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) {
+    player_serfs[i].clear();
+    player_buildings[i].clear();
+    player_inventories[i].clear();
+  }
+  inventory_serfs.clear();
+  parked_serfs.clear();
+  stock_parked.clear();
+  awake_stocks.clear();
+  stock_timers.reset(tick);
+  settled_buildings.clear();
+  idle_flags.clear();
+  military_buildings.clear();
+  influence_sources.clear();
+  for (int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) {
+    influence_maps[i].clear();
+  }
+  serf_pos_first.clear();
+  serf_pos_next.clear();
+  serf_pos_prev.clear();
+  building_buckets.clear();
+  for (int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) {
+    build_possibilities[i].clear();
+    build_possibility_squares[i].clear();
+  }
+  flag_routes.clear();
+}
+
+/* Build the secondary indexes from scratch. Used when the map has been
+   replaced and after objects have been loaded from a saved game. */
+void
+Game::rebuild_indexes() {
+  clear_indexes();
+
+  if (map != NULL) {
+    serf_pos_first.resize(map->get_cols() * map->get_rows(),
+                          SERF_POS_LIST_END);
+    building_buckets.resize((map->get_cols() * map->get_rows()) >>
+                            (2*BUILDING_BUCKET_SHIFT));
+  }
+
+  for (Serfs::Iterator i = serfs.begin(); i != serfs.end(); ++i) {
+    Serf *serf = *i;
+    if (serf->get_player() < GAME_MAX_PLAYER_COUNT) {
+      player_serfs[serf->get_player()].insert(serf->get_index());
+    }
+    if (serf->get_state() == Serf::StateIdleInStock) {
+      serf_entered_stock(serf);
+    }
+    link_serf_pos(serf->get_index(), serf->get_pos());
+  }
+
+  for (Buildings::Iterator i = buildings.begin(); i != buildings.end(); ++i) {
+    Building *building = *i;
+    /* Index 0 is undefined */
+    if (building->get_index() == 0) continue;
+    player_buildings[building->get_owner()].insert(building->get_index());
+    if (building->is_military()) {
+      military_buildings.insert(building->get_index());
+    }
+    link_building_pos(building);
+  }
 
   for (Inventories::Iterator i = inventories.begin();
        i != inventories.end(); ++i) {
     Inventory *inventory = *i;
-    if (inventory->get_owner() == player->get_index()) {
-      player_inventories.push_back(inventory);
-    }
+    player_inventories[inventory->get_owner()].insert(inventory->get_index());
   }
+}
+
+Game::ViewSerfs
+Game::get_player_serfs(Player *player) {
+  return serfs.get_view(player_serfs[player->get_index()]);
+}
+
+Game::ViewBuildings
+Game::get_player_buildings(Player *player) {
+  return buildings.get_view(player_buildings[player->get_index()]);
+}
 
-  return player_inventories;
+Game::ViewInventories
+Game::get_player_inventories(Player *player) {
+  return inventories.get_view(player_inventories[player->get_index()]);
 }
 
+/* Return the serfs at pos in index order. */
 Game::ListSerfs
 Game::get_serfs_at_pos(MapPos pos) {
   ListSerfs result;
+  if (pos >= serf_pos_first.size()) return result;
 
-  for (Serfs::Iterator i = serfs.begin(); i != serfs.end(); ++i) {
-    Serf *serf = *i;
-    if (serf->get_pos() == pos) {
-      result.push_back(serf);
-    }
+  std::vector<unsigned int> indexes;
+  for (unsigned int i = serf_pos_first[pos]; i != SERF_POS_LIST_END;
+       i = serf_pos_next[i]) {
+    indexes.push_back(i);
+  }
+  std::sort(indexes.begin(), indexes.end());
+
+  for (size_t i = 0; i < indexes.size(); i++) {
+    result.push_back(serfs[indexes[i]]);
   }
 
   return result;
 }
 
-Game::ListSerfs
-Game::get_serfs_in_inventory(Inventory *inventory) {
-  ListSerfs result;
-
-  for (Serfs::Iterator i = serfs.begin(); i != serfs.end(); ++i) {
-    Serf *serf = *i;
-    if (serf->get_state() == Serf::StateIdleInStock &&
-        inventory->get_index() == serf->get_idle_in_stock_inv_index()) {
-      result.push_back(serf);
+/* Return the buildings at most radius columns and rows from pos. */
+Game::ListBuildings
+Game::get_buildings_around(MapPos pos, int radius) {
+  ListBuildings result;
+  if (building_buckets.empty()) return result;
+
+  int cols = map->get_cols();
+  int rows = map->get_rows();
+  int bucket_cols = cols >> BUILDING_BUCKET_SHIFT;
+  int bucket_rows = rows >> BUILDING_BUCKET_SHIFT;
+
+  /* Squares from the first to the last one that the area overlaps. */
+  int first_col = (map->pos_col(pos) - radius + cols) >> BUILDING_BUCKET_SHIFT;
+  int last_col = (map->pos_col(pos) + radius + cols) >> BUILDING_BUCKET_SHIFT;
+  int first_row = (map->pos_row(pos) - radius + rows) >> BUILDING_BUCKET_SHIFT;
+  int last_row = (map->pos_row(pos) + radius + rows) >> BUILDING_BUCKET_SHIFT;
+  int col_count = std::min(last_col - first_col + 1, bucket_cols);
+  int row_count = std::min(last_row - first_row + 1, bucket_rows);
+
+  for (int r = 0; r < row_count; r++) {
+    int bucket_row = (first_row + r) % bucket_rows;
+    for (int c = 0; c < col_count; c++) {
+      int bucket_col = (first_col + c) % bucket_cols;
+      const std::vector<unsigned int> &bucket =
+        building_buckets[bucket_row*bucket_cols + bucket_col];
+      for (size_t i = 0; i < bucket.size(); i++) {
+        Building *building = buildings[bucket[i]];
+        MapPos bld_pos = building->get_position();
+        int dist_col = (map->pos_col(bld_pos) - map->pos_col(pos)) &
+                       map->get_col_mask();
+        int dist_row = (map->pos_row(bld_pos) - map->pos_row(pos)) &
+                       map->get_row_mask();
+        if ((dist_col <= radius || dist_col >= cols - radius) &&
+            (dist_row <= radius || dist_row >= rows - radius)) {
+          result.push_back(building);
+        }
+      }
     }
   }
 
   return result;
 }
 
+Game::ViewSerfs
+Game::get_serfs_in_inventory(Inventory *inventory) {
+  unsigned int index = inventory->get_index();
+  if (index >= inventory_serfs.size()) {
+    inventory_serfs.resize(index + 1);
+  }
+
+  return serfs.get_view(inventory_serfs[index]);
+}
+
 Game::ListSerfs
 Game::get_serfs_related_to(unsigned int dest, Direction dir) {
   ListSerfs result;
@@ -2604,6 +3584,7 @@ operator >> (SaveReaderBinary &reader, Game &game) {
   reader >> v16;  // 190
   game.map = new Map();
   game.map->init(v16);
+  game.map->add_change_handler(&game);
 
   reader.skip(8);
   reader >> v16;  // 200
@@ -2637,6 +3618,8 @@ operator >> (SaveReaderBinary &reader, Game &game) {
   game.load_buildings(&reader, max_building_index);
   game.load_inventories(&reader, max_inventory_index);
 
+  game.rebuild_indexes();
+
   game.game_speed = 0;
   game.game_speed_save = DEFAULT_GAME_SPEED;
 
@@ -2768,9 +3751,11 @@ operator >> (SaveReaderText &reader, Game &game) {
   }
 
   /* Initialize remaining map dimensions. */
+  game.deinit();
   game.map = new Map();
   game.map->init(size);
   game.map->init_dimensions();
+  game.map->add_change_handler(&game);
   sections = reader.get_sections("map");
   for (Readers::iterator it = sections.begin(); it != sections.end(); ++it) {
     **it >> *game.map;
@@ -2885,6 +3870,8 @@ operator >> (SaveReaderText &reader, Game &game) {
     game.map->set_obj_index(flag->get_position(), flag->get_index());
   }
 
+  game.rebuild_indexes();
+
   game.game_speed = 0;
   game.game_speed_save = DEFAULT_GAME_SPEED;
 
@@ -2893,6 +3880,8 @@ operator >> (SaveReaderText &reader, Game &game) {
 
 SaveWriterText&
 operator << (SaveWriterText &writer, Game &game) {
+  game.update_parked_serfs();
+
   writer.value("map.size") << game.map->get_size();
   writer.value("game_type") << game.game_type;
   writer.value("tick") << game.tick;
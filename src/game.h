@@ -23,6 +23,7 @@
 #define SRC_GAME_H_
 
 #include <vector>
+#include <deque>
 #include <map>
 #include <string>
 #include <list>
@@ -34,16 +35,75 @@
 #include "src/random.h"
 #include "src/objects.h"
 #include "src/event_loop.h"
+#include "src/profiler.h"
 
 #define DEFAULT_GAME_SPEED  2
 
-#define GAME_MAX_PLAYER_COUNT  4
+#define GAME_RESOURCE_DEMAND_TYPES  (Resource::GroupFood + 1)
+
+/* Marks the end of the lists of serfs at each map position. */
+#define SERF_POS_LIST_END  UINT_MAX
+
+/* Number of slots in each level of a timer wheel, and the number of
+   levels. */
+#define TIMER_WHEEL_BITS    8
+#define TIMER_WHEEL_SLOTS   (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS  3
+
+/* Number of player distribution priorities used by Building::update(). */
+#define BUILDING_PRIORITY_SETTINGS  14
+
+/* Radius of the square around a military building where it has an
+   influence on land ownership. */
+#define MILITARY_INFLUENCE_RADIUS  8
+
+/* Marks the positions in Game::build_possibilities that have to be
+   found again. */
+#define BUILD_POSSIBILITY_UNKNOWN  0xff
+
+/* Known build possibilities are tracked in squares of this many
+   positions on each side (as a power of two). */
+#define BUILD_POSSIBILITY_SQUARE_SHIFT  3
+
+/* Buildings are indexed by position in squares of this many positions
+   on each side (as a power of two). */
+#define BUILDING_BUCKET_SHIFT  4
 
 class SaveReaderBinary;
 class SaveReaderText;
 class SaveWriterText;
 
-class Game : public EventLoop::Handler {
+/* Hierarchical timer wheel of game ticks. The first level has a slot
+   for each of the next TIMER_WHEEL_SLOTS ticks, and each further level
+   has slots spanning TIMER_WHEEL_SLOTS times as many ticks. When the
+   wheel reaches a slot of a higher level, its timers are moved down to
+   the level below. Timers further away than the last level covers are
+   kept in its last slot and moved again until they are in range. */
+class TimerWheel {
+ public:
+  typedef struct Timer {
+    unsigned int tick;
+    unsigned int id;
+    uint32_t data;
+  } Timer;
+
+ protected:
+  std::vector<Timer> slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  unsigned int current;
+  size_t count;
+
+  void insert(const Timer &timer);
+
+ public:
+  TimerWheel();
+
+  void reset(unsigned int tick);
+  void schedule(unsigned int tick, unsigned int id, uint32_t data);
+  void advance(unsigned int tick, std::vector<Timer> *expired);
+  size_t size() const { return count; }
+};
+
+class Game : public EventLoop::Handler, public Map::Handler {
  protected:
   typedef Collection<Flag> Flags;
   typedef Collection<Inventory> Inventories;
@@ -54,7 +114,19 @@ class Game : public EventLoop::Handler {
  public:
   typedef std::list<Serf*> ListSerfs;
   typedef std::list<Building*> ListBuildings;
-  typedef std::list<Inventory*> ListInventories;
+
+  /* What a player can build at a map position. */
+  typedef enum BuildPossibility {
+    BuildPossibilityNone = 0,
+    BuildPossibilityFlag,
+    BuildPossibilityMine,
+    BuildPossibilitySmall,
+    BuildPossibilityLarge,
+    BuildPossibilityCastle,
+  } BuildPossibility;
+  typedef Serfs::View ViewSerfs;
+  typedef Buildings::View ViewBuildings;
+  typedef Inventories::View ViewInventories;
 
  protected:
   Map *map;
@@ -68,6 +140,56 @@ class Game : public EventLoop::Handler {
   Buildings buildings;
   Serfs serfs;
 
+  /* Secondary indexes of the objects, kept up to date as objects are
+     created, deleted or change owner, state or position. */
+  Serfs::Subset player_serfs[GAME_MAX_PLAYER_COUNT];
+  Buildings::Subset player_buildings[GAME_MAX_PLAYER_COUNT];
+  Inventories::Subset player_inventories[GAME_MAX_PLAYER_COUNT];
+  std::deque<Serfs::Subset> inventory_serfs;
+  /* Idle serfs in stock that are not updated, see park_stock_serfs().
+     For each inventory the id of its parking (zero when its serfs are
+     updated), the inventories to check for parking and the timers of
+     knights that are parked while in training. The parked serfs are
+     up to date as of the serf update at serf_update_tick. */
+  Serfs::Subset parked_serfs;
+  std::vector<uint32_t> stock_parked;
+  uint32_t stock_parking_counter;
+  Inventories::Subset awake_stocks;
+  TimerWheel stock_timers;
+  uint32_t serf_update_tick;
+  /* Buildings that are not updated, see Building::is_settled(), and the
+     distribution priorities of each player when last checked. */
+  Buildings::Subset settled_buildings;
+  /* Flags that are not updated, see Flag::is_idle(). */
+  Flags::Subset idle_flags;
+  int building_priorities[GAME_MAX_PLAYER_COUNT][BUILDING_PRIORITY_SETTINGS];
+  /* Military buildings, the influence on land ownership of each player
+     at each map position, and the influence each building has been added
+     with, see update_military_influence(). */
+  typedef struct InfluenceSource {
+    MapPos pos;
+    int player;
+    int type;
+  } InfluenceSource;
+  Buildings::Subset military_buildings;
+  std::vector<uint32_t> influence_maps[GAME_MAX_PLAYER_COUNT];
+  std::vector<InfluenceSource> influence_sources;
+  /* Buildings in each square of BUILDING_BUCKET_SHIFT positions, by
+     rows of squares. */
+  std::vector<std::vector<unsigned int> > building_buckets;
+  /* What each player can build at each map position, and whether the
+     player had a castle then. Positions near changes of the map are
+     set to BUILD_POSSIBILITY_UNKNOWN and found again when needed. */
+  std::vector<uint8_t> build_possibilities[GAME_MAX_PLAYER_COUNT];
+  bool build_possibilities_castle[GAME_MAX_PLAYER_COUNT];
+  /* Whether each square of BUILD_POSSIBILITY_SQUARE_SHIFT positions has
+     any known build possibilities, by rows of squares. */
+  std::vector<bool> build_possibility_squares[GAME_MAX_PLAYER_COUNT];
+  /* Serfs at each map position as doubly linked lists of serf indexes. */
+  std::vector<unsigned int> serf_pos_first;
+  std::vector<unsigned int> serf_pos_next;
+  std::vector<unsigned int> serf_pos_prev;
+
   Random init_map_rnd;
   unsigned int game_speed_save;
   unsigned int game_speed;
@@ -78,7 +200,17 @@ class Game : public EventLoop::Handler {
   unsigned int history_counter;
   Random rnd;
   uint16_t next_index;
-  uint16_t flag_search_counter;
+  uint32_t flag_search_counter;
+  uint32_t flag_network_epoch[GAME_MAX_PLAYER_COUNT];
+  uint32_t road_network_epoch[GAME_MAX_PLAYER_COUNT];
+  uint32_t inventory_epoch[GAME_MAX_PLAYER_COUNT];
+  FlagRoutes flag_routes;
+
+  /* Flags of the buildings requesting each resource, per player. Only
+     valid during update_flags(). */
+  std::vector<unsigned int> resource_demand[GAME_MAX_PLAYER_COUNT]
+                                           [GAME_RESOURCE_DEMAND_TYPES];
+  bool resource_demand_valid;
 
   uint16_t update_map_last_tick;
   int16_t update_map_counter;
@@ -102,6 +234,9 @@ class Game : public EventLoop::Handler {
   int knight_morale_counter;
   int inventory_schedule_counter;
 
+  TickProfiler *profiler;
+  SerfStateProfiler *serf_profiler;
+
  public:
   explicit Game(int map_generator);
   virtual ~Game();
@@ -123,6 +258,7 @@ class Game : public EventLoop::Handler {
   bool load_mission_map(int m);
   bool load_random_map(int size, const Random &rnd);
   bool load_save_game(const std::string &path);
+  void seed_random(const Random &rnd);
 
   void update();
   void pause();
@@ -130,6 +266,12 @@ class Game : public EventLoop::Handler {
   void speed_decrease();
   void speed_reset();
 
+  void enable_profiler(bool enable);
+  TickProfiler *get_profiler() { return profiler; }
+  void enable_serf_profiler(bool enable);
+  SerfStateProfiler *get_serf_profiler() { return serf_profiler; }
+  void log_object_usage();
+
   void prepare_ground_analysis(MapPos pos, int estimates[5]);
   bool send_geologist(Flag *dest);
 
@@ -144,6 +286,8 @@ class Game : public EventLoop::Handler {
   bool can_build_castle(MapPos pos, const Player *player);
   bool can_build_flag(MapPos pos, const Player *player);
   bool can_player_build(MapPos pos, const Player *player);
+  BuildPossibility get_build_possibility(MapPos pos, const Player *player);
+  void invalidate_build_possibilities(MapPos pos);
 
   int can_build_road(const Road &road, const Player *player,
                      MapPos *dest, bool *water);
@@ -183,28 +327,61 @@ class Game : public EventLoop::Handler {
     return player_history_index[scale]; }
   int get_resource_history_index() const { return resource_history_index; }
 
-  int next_search_id();
+  unsigned int next_search_id();
+
+  /* The flag network epoch of a player changes whenever roads,
+     transporters or inventories of that player change. Results of
+     flag searches can be kept until then. The road network epoch only
+     changes with the roads themselves. */
+  uint32_t get_flag_network_epoch(unsigned int player) const {
+    return flag_network_epoch[player]; }
+  uint32_t get_road_network_epoch(unsigned int player) const {
+    return road_network_epoch[player]; }
+  void flag_network_changed(unsigned int player);
+  void road_network_changed(unsigned int player);
+  /* The inventory epoch of a player changes whenever an inventory of
+     that player gains a serf type or a resource it had none of, or its
+     fifth free serf. Failed serf requests can be kept until then. */
+  uint32_t get_inventory_epoch(unsigned int player) const {
+    return inventory_epoch[player]; }
+  void inventory_gained(unsigned int player);
+  FlagRoutes *get_flag_routes() { return &flag_routes; }
+  const std::vector<unsigned int> *get_resource_demand(unsigned int player,
+                                                      Resource::Type res);
 
   Serf *create_serf(int index = -1);
   void delete_serf(Serf *serf);
   Flag *create_flag(int index = -1);
   Inventory *create_inventory(int index = -1);
+  void delete_inventory(Inventory *inventory);
   Building *create_building(int index = -1);
   void delete_building(Building *building);
 
+  void serf_owner_changed(Serf *serf, unsigned int old_owner);
+  void serf_pos_changed(Serf *serf, MapPos old_pos);
+  void serf_entered_stock(Serf *serf);
+  void serf_left_stock(Serf *serf);
+  void wake_stock_serfs(unsigned int inventory);
+  void wake_building(unsigned int index) { settled_buildings.erase(index); }
+  void wake_flag(unsigned int index) { idle_flags.erase(index); }
+  void update_parked_serfs();
+  void building_owner_changed(Building *building, unsigned int old_owner);
+  void inventory_owner_changed(Inventory *inventory, unsigned int old_owner);
+
   Serf *get_serf(unsigned int index) { return serfs[index]; }
   Flag *get_flag(unsigned int index) { return flags[index]; }
   Inventory *get_inventory(unsigned int index) { return inventories[index]; }
   Building *get_building(unsigned int index) { return buildings[index]; }
   Player *get_player(unsigned int index) { return players[index]; }
 
-  ListSerfs get_player_serfs(Player *player);
-  ListBuildings get_player_buildings(Player *player);
-  ListSerfs get_serfs_in_inventory(Inventory *inventory);
+  ViewSerfs get_player_serfs(Player *player);
+  ViewBuildings get_player_buildings(Player *player);
+  ViewSerfs get_serfs_in_inventory(Inventory *inventory);
   ListSerfs get_serfs_related_to(unsigned int dest, Direction dir);
-  ListInventories get_player_inventories(Player *player);
+  ViewInventories get_player_inventories(Player *player);
 
   ListSerfs get_serfs_at_pos(MapPos pos);
+  ListBuildings get_buildings_around(MapPos pos, int radius);
   Flag *gat_flag_at_pos(MapPos pos);
 
   Player *get_next_player(Player *player);
@@ -215,15 +392,28 @@ class Game : public EventLoop::Handler {
  protected:
   void allocate_objects();
   void deinit();
+  void clear_indexes();
+  void rebuild_indexes();
+  void link_serf_pos(unsigned int index, MapPos pos);
+  void unlink_serf_pos(unsigned int index, MapPos pos);
+  size_t get_building_bucket(MapPos pos);
+  size_t get_build_possibility_square(MapPos pos);
+  void link_building_pos(Building *building);
+  void unlink_building_pos(Building *building);
 
   void clear_serf_request_failure();
   void update_knight_morale();
   static bool update_inventories_cb(Flag *flag, void *data);
   void update_inventories();
   void update_flags();
+  void collect_resource_demand();
   static bool send_serf_to_flag_search_cb(Flag *flag, void *data);
   void update_buildings();
+  void wake_buildings_on_priority_change();
   void update_serfs();
+  void update_serfs_profiled();
+  void wake_stock_timers();
+  void park_stock_serfs();
   void record_player_history(int max_level, int aspect,
                              const int history_index[], const values_t &values);
   int calculate_clear_winner(const values_t &values);
@@ -237,9 +427,15 @@ class Game : public EventLoop::Handler {
   bool demolish_road_(MapPos pos);
   void build_flag_split_path(MapPos pos);
   bool map_types_within(MapPos pos, Map::Terrain low, Map::Terrain high);
+  BuildPossibility find_build_possibility(MapPos pos, const Player *player);
   void flag_remove_player_refs(Flag *flag);
   bool demolish_flag_(MapPos pos);
   bool demolish_building_(MapPos pos);
+  int get_military_influence_type(Building *building);
+  void add_military_influence(const InfluenceSource &source, int sign);
+  void update_military_influence();
+  int get_military_influence(unsigned int player, MapPos pos);
+  void find_military_influence(MapPos init_pos, int *temp_arr);
   void surrender_land(MapPos pos);
   void demolish_flag_and_roads(MapPos pos);
   void init_map(int size);
@@ -248,6 +444,10 @@ class Game : public EventLoop::Handler {
  public:
   virtual bool handle_event(const Event *event);
 
+  /* Implementation of Map::Handler */
+  virtual void on_height_changed(MapPos pos);
+  virtual void on_object_changed(MapPos pos);
+
   friend SaveReaderBinary&
     operator >> (SaveReaderBinary &reader, Game &game);
   friend SaveReaderText&
@@ -181,37 +181,15 @@ Interface::close_message() {
 /* Return the cursor type and various related values of a MapPos. */
 void
 Interface::get_map_cursor_type(const Player *player, MapPos pos,
-                               BuildPossibility *bld_possibility,
+                               Game::BuildPossibility *bld_possibility,
                                CursorType *cursor_type) {
   if (player == NULL) {
-    *bld_possibility = BuildPossibilityNone;
+    *bld_possibility = Game::BuildPossibilityNone;
     *cursor_type = CursorTypeClear;
     return;
   }
 
-  if (game->can_build_castle(pos, player)) {
-    *bld_possibility = BuildPossibilityCastle;
-  } else if (game->can_player_build(pos, player) &&
-       Map::map_space_from_obj[game->get_map()->get_obj(pos)] ==
-         Map::SpaceOpen &&
-       (game->can_build_flag(game->get_map()->move_down_right(pos), player) ||
-        game->get_map()->has_flag(game->get_map()->move_down_right(pos)))) {
-    if (game->can_build_mine(pos)) {
-      *bld_possibility = BuildPossibilityMine;
-    } else if (game->can_build_large(pos)) {
-      *bld_possibility = BuildPossibilityLarge;
-    } else if (game->can_build_small(pos)) {
-      *bld_possibility = BuildPossibilitySmall;
-    } else if (game->can_build_flag(pos, player)) {
-      *bld_possibility = BuildPossibilityFlag;
-    } else {
-      *bld_possibility = BuildPossibilityNone;
-    }
-  } else if (game->can_build_flag(pos, player)) {
-    *bld_possibility = BuildPossibilityFlag;
-  } else {
-    *bld_possibility = BuildPossibilityNone;
-  }
+  *bld_possibility = game->get_build_possibility(pos, player);
 
   if (game->get_map()->get_obj(pos) == Map::ObjectFlag &&
       game->get_map()->get_owner(pos) == player->get_index()) {
@@ -318,12 +296,12 @@ Interface::update_interface() {
     case CursorTypePath:
       map_cursor_sprites[0].sprite = 52;
       map_cursor_sprites[2].sprite = 33;
-      if (build_possibility != BuildPossibilityNone) {
+      if (build_possibility != Game::BuildPossibilityNone) {
         map_cursor_sprites[0].sprite = 47;
       }
       break;
     case CursorTypeClearByFlag:
-      if (build_possibility < BuildPossibilityMine) {
+      if (build_possibility < Game::BuildPossibilityMine) {
         map_cursor_sprites[0].sprite = 32;
         map_cursor_sprites[2].sprite = 33;
       } else {
@@ -332,9 +310,9 @@ Interface::update_interface() {
       }
       break;
     case CursorTypeClearByPath:
-      if (build_possibility != BuildPossibilityNone) {
+      if (build_possibility != Game::BuildPossibilityNone) {
         map_cursor_sprites[0].sprite = 46 + build_possibility;
-        if (build_possibility == BuildPossibilityFlag) {
+        if (build_possibility == Game::BuildPossibilityFlag) {
           map_cursor_sprites[2].sprite = 33;
         } else {
           map_cursor_sprites[2].sprite = 47;
@@ -346,12 +324,12 @@ Interface::update_interface() {
       break;
     case CursorTypeClear:
       if (build_possibility) {
-        if (build_possibility == BuildPossibilityCastle) {
+        if (build_possibility == Game::BuildPossibilityCastle) {
           map_cursor_sprites[0].sprite = 50;
         } else {
           map_cursor_sprites[0].sprite = 46 + build_possibility;
         }
-        if (build_possibility == BuildPossibilityFlag) {
+        if (build_possibility == Game::BuildPossibilityFlag) {
           map_cursor_sprites[2].sprite = 33;
         } else {
           map_cursor_sprites[2].sprite = 47;
@@ -419,8 +397,8 @@ Interface::set_player(unsigned int player) {
     add_float(panel, 0, 0);
     layout();
 
-    Game::ListBuildings buildings = game->get_player_buildings(this->player);
-    for (Game::ListBuildings::iterator it = buildings.begin();
+    Game::ViewBuildings buildings = game->get_player_buildings(this->player);
+    for (Game::ViewBuildings::iterator it = buildings.begin();
          it != buildings.end(); ++it) {
       Building *building = *it;
       if (building->get_type() == Building::TypeCastle) {
@@ -701,7 +679,7 @@ Interface::Interface() {
 
   map_cursor_pos = 0;
   map_cursor_type = (CursorType)0;
-  build_possibility = BuildPossibilityNone;
+  build_possibility = Game::BuildPossibilityNone;
 
   player = NULL;
 
@@ -868,6 +846,15 @@ Interface::handle_key_pressed(char key, int modifier) {
       viewport->switch_layer(Viewport::LayerGrid);
       break;
     }
+    case 'o': {
+      if (game->get_profiler() != NULL) {
+        game->get_profiler()->dump();
+      }
+      if (game->get_serf_profiler() != NULL) {
+        game->get_serf_profiler()->dump();
+      }
+      break;
+    }
 
     /* Game control */
     case 'b': {
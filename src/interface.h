@@ -27,6 +27,7 @@
 #include "src/map.h"
 #include "src/player.h"
 #include "src/building.h"
+#include "src/game.h"
 #include "src/gui.h"
 
 static const unsigned int map_building_sprite[] = {
@@ -55,15 +56,6 @@ class Interface : public GuiObject {
     CursorTypeClear
   } CursorType;
 
-  typedef enum BuildPossibility {
-    BuildPossibilityNone = 0,
-    BuildPossibilityFlag,
-    BuildPossibilityMine,
-    BuildPossibilitySmall,
-    BuildPossibilityLarge,
-    BuildPossibilityCastle,
-  } BuildPossibility;
-
  protected:
   typedef struct SpriteLoc {
     int sprite;
@@ -83,7 +75,7 @@ class Interface : public GuiObject {
 
   MapPos map_cursor_pos;
   CursorType map_cursor_type;
-  BuildPossibility build_possibility;
+  Game::BuildPossibility build_possibility;
 
   unsigned int last_const_tick;
 
@@ -138,7 +130,8 @@ class Interface : public GuiObject {
   int get_current_stat_7_item() const { return current_stat_7_item; }
   void set_current_stat_7_item(int item) { current_stat_7_item = item; }
 
-  BuildPossibility get_build_possibility() const { return build_possibility; }
+  Game::BuildPossibility get_build_possibility() const {
+    return build_possibility; }
 
   void open_popup(int box);
   void close_popup();
@@ -178,7 +171,7 @@ class Interface : public GuiObject {
 
  protected:
   void get_map_cursor_type(const Player *player, MapPos pos,
-                           BuildPossibility *bld_possibility,
+                           Game::BuildPossibility *bld_possibility,
                            CursorType *cursor_type);
   void determine_map_cursor_type();
   void determine_map_cursor_type_road();
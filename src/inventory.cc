@@ -51,8 +51,16 @@ Inventory::Inventory(Game *game, unsigned int index)
   generic_count = 0;
 }
 
+void
+Inventory::set_owner(unsigned int owner) {
+  unsigned int old_owner = this->owner;
+  this->owner = owner;
+  game->inventory_owner_changed(this, old_owner);
+}
+
 void
 Inventory::push_resource(Resource::Type resource) {
+  if (resources[resource] == 0) game->inventory_gained(owner);
   resources[resource] += (resources[resource] < 50000) ? 1 : 0;
 }
 
@@ -171,6 +179,14 @@ Inventory::apply_supplies_preset(size_t supplies) {
     if (n >= 0x8000) t1 += 1;
     resources[(Resource::Type)i] = t1 + (n >> 16);
   }
+
+  game->inventory_gained(owner);
+}
+
+void
+Inventory::set_serf_mode(Inventory::Mode mode) {
+  res_dir = (res_dir & 0xF3) | (mode << 2);
+  game->wake_stock_serfs(index);
 }
 
 Serf*
@@ -210,6 +226,7 @@ Inventory::call_transporter(bool water) {
   }
 
   serfs_out += 1;
+  game->wake_stock_serfs(index);
 
   return serf;
 }
@@ -225,9 +242,18 @@ Inventory::call_out_serf(Serf *serf) {
     generic_count--;
   }
   serfs_out++;
+  game->wake_stock_serfs(index);
   return true;
 }
 
+/* A generic serf returned to the inventory. Requests for generic serfs
+   wait for the fifth free serf, see Game::send_serf_to_flag(). */
+void
+Inventory::serf_come_back() {
+  generic_count++;
+  if (generic_count == 5) game->inventory_gained(owner);
+}
+
 Serf*
 Inventory::call_out_serf(Serf::Type type) {
   if (serfs[type] == 0) {
@@ -249,6 +275,7 @@ Inventory::call_internal(Serf *serf) {
   }
 
   serfs[serf->get_type()] = 0;
+  game->wake_stock_serfs(index);
 
   return true;
 }
@@ -261,6 +288,7 @@ Inventory::call_internal(Serf::Type type) {
 
   Serf *serf = game->get_serf(serfs[type]);
   serfs[type] = 0;
+  game->wake_stock_serfs(index);
 
   return serf;
 }
@@ -280,6 +308,7 @@ Inventory::promote_serf_to_knight(Serf *serf) {
   pop_resource(Resource::TypeShield);
   generic_count--;
   serfs[Serf::TypeGeneric] = 0;
+  game->wake_stock_serfs(index);
 
   serf->set_type(Serf::TypeKnight0);
 
@@ -296,7 +325,11 @@ Inventory::spawn_serf_generic() {
     generic_count++;
     if (serfs[Serf::TypeGeneric] == 0) {
       serfs[Serf::TypeGeneric] = serf->get_index();
+      game->inventory_gained(owner);
+    } else if (generic_count == 5) {
+      game->inventory_gained(owner);
     }
+    game->wake_stock_serfs(index);
   }
 
   return serf;
@@ -367,6 +400,8 @@ Inventory::specialize_serf(Serf *serf, Serf::Type type) {
   serf->set_type(type);
 
   serfs[type] = serf->get_index();
+  game->inventory_gained(owner);
+  game->wake_stock_serfs(index);
 
   return true;
 }
@@ -402,6 +437,7 @@ Inventory::serf_potencial_count(Serf::Type type) {
 
 void
 Inventory::serf_idle_in_stock(Serf *serf) {
+  if (serfs[serf->get_type()] == 0) game->inventory_gained(owner);
   serfs[serf->get_type()] = serf->get_index();
 }
 
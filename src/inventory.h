@@ -64,7 +64,7 @@ class Inventory : public GameObject {
   Inventory(Game *game, unsigned int index);
 
   unsigned int get_owner() { return owner; }
-  void set_owner(unsigned int owner) { this->owner = owner; }
+  void set_owner(unsigned int owner);
 
   int get_flag_index() { return flag; }
   void set_flag_index(int flag_index) { flag = flag_index; }
@@ -76,8 +76,7 @@ class Inventory : public GameObject {
   void set_res_mode(Inventory::Mode mode) { res_dir = (res_dir & 0xFC) | mode; }
   Inventory::Mode get_serf_mode() {
     return (Inventory::Mode)((res_dir >> 2) & 3); }
-  void set_serf_mode(Inventory::Mode mode) {
-    res_dir = (res_dir & 0xF3) | (mode << 2); }
+  void set_serf_mode(Inventory::Mode mode);
   bool have_any_out_mode() { return ((res_dir & 0x0A) != 0); }
 
   int get_serf_queue_length() { return serfs_out; }
@@ -86,9 +85,10 @@ class Inventory : public GameObject {
   Serf *call_out_serf(Serf::Type type);
   bool call_internal(Serf *serf);
   Serf *call_internal(Serf::Type type);
-  void serf_come_back() { generic_count++; }
+  void serf_come_back();
   size_t free_serf_count() { return generic_count; }
   bool have_serf(Serf::Type type) { return (serfs[type] != 0); }
+  unsigned int get_registered_serf(Serf::Type type) { return serfs[type]; }
 
   size_t get_count_of(Resource::Type resource) { return resources[resource]; }
   resource_map_t get_all_resources() { return resources; }
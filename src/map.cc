@@ -129,6 +129,10 @@ static int spiral_pattern[] = {
   24, 16, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
 
+/* Largest column or row offset of the spiral pattern up to each index.
+   Filled out by init_spiral_pattern(). */
+static int spiral_radius[295];
+
 static int spiral_pattern_initialized = 0;
 
 /* Initialize the global spiral_pattern. */
@@ -159,6 +163,13 @@ init_spiral_pattern() {
     }
   }
 
+  int radius = 0;
+  for (int i = 0; i < 295; i++) {
+    radius = std::max(radius, abs(spiral_pattern[2*i]));
+    radius = std::max(radius, abs(spiral_pattern[2*i+1]));
+    spiral_radius[i] = radius;
+  }
+
   spiral_pattern_initialized = 1;
 }
 
@@ -167,6 +178,14 @@ Map::get_spiral_pattern() {
   return spiral_pattern;
 }
 
+/* Return the largest column or row offset of the spiral pattern from
+   the center up to index. */
+int
+Map::get_spiral_radius(unsigned int index) {
+  init_spiral_pattern();
+  return spiral_radius[index];
+}
+
 /* Map Object to Space. */
 const Map::Space
 Map::map_space_from_obj[] = {
@@ -320,17 +339,13 @@ Map::map_space_from_obj[] = {
 };
 
 Map::Map() {
-  tiles = NULL;
   minimap = NULL;
   spiral_pos_pattern = NULL;
+  neighbours = NULL;
+  object_index_valid = false;
 }
 
 Map::~Map() {
-  if (tiles != NULL) {
-    delete[] tiles;
-    tiles = NULL;
-  }
-
   if (minimap != NULL) {
     delete[] minimap;
     minimap = NULL;
@@ -340,15 +355,15 @@ Map::~Map() {
     delete[] spiral_pos_pattern;
     spiral_pos_pattern = NULL;
   }
+
+  if (neighbours != NULL) {
+    delete[] neighbours;
+    neighbours = NULL;
+  }
 }
 
 void
 Map::init(unsigned int size) {
-  if (tiles != NULL) {
-    delete[] tiles;
-    tiles = NULL;
-  }
-
   if (minimap != NULL) {
     delete[] minimap;
     minimap = NULL;
@@ -393,18 +408,87 @@ void
 Map::init_ground_gold_deposit() {
   int total_gold = 0;
 
-  for (unsigned int y = 0; y < rows; y++) {
-    for (unsigned int x = 0; x < cols; x++) {
-      MapPos pos_ = pos(x, y);
-      if (get_res_type(pos_) == MineralsGold) {
-        total_gold += get_res_amount(pos_);
-      }
+  for (MapPos pos_ = 0; pos_ < tile_count; pos_++) {
+    if ((tile_resource[pos_] >> 5) == MineralsGold) {
+      total_gold += tile_resource[pos_] & 0x1f;
     }
   }
 
   gold_deposit = total_gold;
 }
 
+/* The tile planes are scanned a word of eight positions at a time. */
+static uint64_t
+load_plane_word(const uint8_t *data) {
+  uint64_t word;
+  memcpy(&word, data, sizeof(word));
+  return word;
+}
+
+static uint64_t
+repeat_byte(uint8_t value) {
+  return 0x0101010101010101ULL * value;
+}
+
+/* Return the number of set bits in a word. */
+static unsigned int
+count_bits(uint64_t bits) {
+#ifdef __GNUC__
+  return __builtin_popcountll(bits);
+#else
+  bits = bits - ((bits >> 1) & 0x5555555555555555ULL);
+  bits = (bits & 0x3333333333333333ULL) +
+         ((bits >> 2) & 0x3333333333333333ULL);
+  bits = (bits + (bits >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (bits * 0x0101010101010101ULL) >> 56;
+#endif
+}
+
+/* Count the positions owned by each player. */
+void
+Map::get_owned_tile_counts(unsigned int counts[GAME_MAX_PLAYER_COUNT]) const {
+  const uint64_t owner_bits = repeat_byte(0xe0);
+  const uint64_t low_bits = repeat_byte(0x7f);
+
+  for (int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) counts[i] = 0;
+
+  MapPos pos = 0;
+  for (; pos + sizeof(uint64_t) <= tile_count; pos += sizeof(uint64_t)) {
+    uint64_t word = load_plane_word(&tile_height[pos]) & owner_bits;
+    if ((word & repeat_byte(BIT(7))) == 0) continue;
+
+    for (int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) {
+      /* Bytes of diff are zero where the owner is player i. The high
+         bit of each byte in zero is set for exactly those bytes. */
+      uint64_t diff = word ^ repeat_byte(BIT(7) | (i << 5));
+      uint64_t zero = ~(((diff & low_bits) + low_bits) | diff | low_bits);
+      counts[i] += count_bits(zero);
+    }
+  }
+
+  for (; pos < tile_count; pos++) {
+    if (has_owner(pos)) counts[get_owner(pos)] += 1;
+  }
+}
+
+/* Return the first position at or after pos where any of the bits
+   in mask are set in the plane, or bad_map_pos. */
+MapPos
+Map::find_next_in_plane(const std::vector<uint8_t> &plane, MapPos pos,
+                        uint8_t mask) const {
+  const uint64_t word_mask = repeat_byte(mask);
+
+  for (; pos + sizeof(uint64_t) <= tile_count; pos += sizeof(uint64_t)) {
+    if ((load_plane_word(&plane[pos]) & word_mask) != 0) break;
+  }
+
+  for (; pos < tile_count; pos++) {
+    if ((plane[pos] & mask) != 0) return pos;
+  }
+
+  return bad_map_pos;
+}
+
 /* Initialize minimap data. */
 void
 Map::init_minimap() {
@@ -431,17 +515,18 @@ Map::init_minimap() {
   minimap = new uint8_t[rows * cols];
   if (minimap == NULL) abort();
 
+  /* The color depends on the slope between the position to the right
+     and the one below, i.e. down left of that. */
   uint8_t *mpos = minimap;
   for (unsigned int y = 0; y < rows; y++) {
-    for (unsigned int x = 0; x < cols; x++) {
-      MapPos pos_ = pos(x, y);
-      int type_off = color_offset[tiles[pos_].type >> 4];
-
-      pos_ = move_right(pos_);
-      int h1 = get_height(pos_);
+    const uint8_t *type = &tile_type[pos(0, y)];
+    const uint8_t *height = &tile_height[pos(0, y)];
+    const uint8_t *height_below = &tile_height[pos(0, (y + 1) & row_mask)];
 
-      pos_ = move_down_left(pos_);
-      int h2 = get_height(pos_);
+    for (unsigned int x = 0; x < cols; x++) {
+      int type_off = color_offset[type[x] >> 4];
+      int h1 = height[(x + 1) & col_mask] & 0x1f;
+      int h2 = height_below[x] & 0x1f;
 
       int h_off = h2 - h1 + 8;
       *(mpos++) = colors[type_off + h_off];
@@ -499,31 +584,55 @@ Map::init_dimensions() {
   dirs[DirectionUpLeft] = dirs[DirectionLeft] | dirs[DirectionUp];
 
   /* Allocate map */
-  if (tiles != NULL) {
-    delete[] tiles;
-    tiles = NULL;
-  }
-  tiles = new Tile[tile_count]();
-  if (tiles == NULL) abort();
+  tile_paths.assign(tile_count, 0);
+  tile_height.assign(tile_count, 0);
+  tile_type.assign(tile_count, 0);
+  tile_obj.assign(tile_count, 0);
+  tile_obj_index.assign(tile_count, 0);
+  tile_resource.assign(tile_count, 0);
+  tile_serf.assign(tile_count, 0);
+  object_index_valid = false;
+
+  init_neighbours();
 
   init_spiral_pos_pattern();
 }
 
+/* Build the table of neighbouring positions used by move(). Each
+   position has a row of (1 << MAP_NEIGHBOUR_SHIFT) entries indexed
+   by direction, so moving is a single table lookup instead of
+   splitting and wrapping the column and row. */
+void
+Map::init_neighbours() {
+  if (neighbours != NULL) {
+    delete[] neighbours;
+    neighbours = NULL;
+  }
+
+  neighbours = new MapPos[tile_count << MAP_NEIGHBOUR_SHIFT]();
+  for (MapPos pos = 0; pos < tile_count; pos++) {
+    for (int d = DirectionRight; d <= DirectionDownLeft; d++) {
+      neighbours[(pos << MAP_NEIGHBOUR_SHIFT) | d] = pos_add(pos, dirs[d]);
+    }
+  }
+}
+
 /* Copy tile data from map generator into map tile data. */
 void
 Map::init_tiles(const MapGenerator &generator) {
   for (unsigned int y = 0; y < rows; y++) {
     for (unsigned int x = 0; x < cols; x++) {
       MapPos pos_ = pos(x, y);
-      tiles[pos_].height = generator.get_height(pos_) & 0x1f;
-      tiles[pos_].type = (generator.get_type_up(pos_) & 0xf) << 4 |
+      tile_height[pos_] = generator.get_height(pos_) & 0x1f;
+      tile_type[pos_] = (generator.get_type_up(pos_) & 0xf) << 4 |
         (generator.get_type_down(pos_) & 0xf);
-      tiles[pos_].obj = generator.get_obj(pos_) & 0x7f;
+      tile_obj[pos_] = generator.get_obj(pos_) & 0x7f;
+      object_index_valid = false;
       if (generator.get_resource_type(pos_) != MineralsNone) {
-        tiles[pos_].resource = (generator.get_resource_type(pos_) & 7) << 5 |
+        tile_resource[pos_] = (generator.get_resource_type(pos_) & 7) << 5 |
           (generator.get_resource_amount(pos_) & 0x1f);
       } else {
-        tiles[pos_].resource = generator.get_resource_amount(pos_);
+        tile_resource[pos_] = generator.get_resource_amount(pos_);
       }
     }
   }
@@ -534,7 +643,7 @@ Map::init_tiles(const MapGenerator &generator) {
 /* Change the height of a map position. */
 void
 Map::set_height(MapPos pos, int height) {
-  tiles[pos].height = (tiles[pos].height & 0xe0) | (height & 0x1f);
+  tile_height[pos] = (tile_height[pos] & 0xe0) | (height & 0x1f);
 
   /* Mark landscape dirty */
   for (int d = DirectionRight; d <= DirectionUp; d++) {
@@ -550,43 +659,146 @@ Map::set_height(MapPos pos, int height) {
    building is removed. */
 void
 Map::set_object(MapPos pos, Object obj, int index) {
-  tiles[pos].obj = (tiles[pos].obj & 0x80) | (obj & 0x7f);
-  if (index >= 0) tiles[pos].obj_index = index;
+  if (object_index_valid) {
+    ObjectClass old_cls = get_object_class(get_obj(pos));
+    ObjectClass new_cls = get_object_class((Object)(obj & 0x7f));
+    if (old_cls != new_cls) {
+      size_t bucket = get_object_bucket(pos);
+      if (old_cls != ObjectClassNone) object_counts[old_cls][bucket] -= 1;
+      if (new_cls != ObjectClassNone) object_counts[new_cls][bucket] += 1;
+    }
+  }
+
+  tile_obj[pos] = (tile_obj[pos] & 0x80) | (obj & 0x7f);
+  if (index >= 0) tile_obj_index[pos] = index;
 
   /* Notify about object change */
-  for (int d = DirectionRight; d <= DirectionUp; d++) {
-    for (change_handlers_t::iterator it = change_handlers.begin();
-         it != change_handlers.end(); ++it) {
-      (*it)->on_object_changed(pos);
-    }
+  notify_object_changed(pos);
+}
+
+void
+Map::add_path(MapPos pos, Direction dir) {
+  if (has_path(pos, dir)) return;
+  tile_paths[pos] |= BIT(dir);
+  notify_object_changed(pos);
+}
+
+void
+Map::del_path(MapPos pos, Direction dir) {
+  if (!has_path(pos, dir)) return;
+  tile_paths[pos] &= ~BIT(dir);
+  notify_object_changed(pos);
+}
+
+void
+Map::set_owner(MapPos pos, unsigned int player) {
+  uint8_t height = (1 << 7) | (player << 5) | get_height(pos);
+  if (tile_height[pos] == height) return;
+  tile_height[pos] = height;
+  notify_object_changed(pos);
+}
+
+void
+Map::del_owner(MapPos pos) {
+  if ((tile_height[pos] & 0xe0) == 0) return;
+  tile_height[pos] &= 0x1f;
+  notify_object_changed(pos);
+}
+
+void
+Map::notify_object_changed(MapPos pos) {
+  for (change_handlers_t::iterator it = change_handlers.begin();
+       it != change_handlers.end(); ++it) {
+    (*it)->on_object_changed(pos);
   }
 }
 
 /* Remove resources from the ground at a map position. */
 void
 Map::remove_ground_deposit(MapPos pos, int amount) {
-  tiles[pos].resource -= amount;
+  tile_resource[pos] -= amount;
 
   if (get_res_amount(pos) == 0) {
     /* Also sets the ground deposit type to none. */
-    tiles[pos].resource = 0;
+    tile_resource[pos] = 0;
   }
 }
 
 /* Remove fish at a map position (must be water). */
 void
 Map::remove_fish(MapPos pos, int amount) {
-  tiles[pos].resource -= amount;
+  tile_resource[pos] -= amount;
 }
 
 /* Set the index of the serf occupying map position. */
 void
 Map::set_serf_index(MapPos pos, int index) {
-  tiles[pos].serf = index;
+  tile_serf[pos] = index;
 
   /* TODO Mark dirty in viewport. */
 }
 
+/* Return the class of the object in the object index. */
+Map::ObjectClass
+Map::get_object_class(Object obj) {
+  if (obj >= ObjectTree0 && obj <= ObjectPine7) return ObjectClassTree;
+  if (obj >= ObjectStone0 && obj <= ObjectStone7) return ObjectClassStone;
+  if (obj == ObjectFlag) return ObjectClassFlag;
+  return ObjectClassNone;
+}
+
+size_t
+Map::get_object_bucket(MapPos pos) const {
+  unsigned int bucket_cols = cols >> MAP_OBJECT_BUCKET_SHIFT;
+  return (pos_row(pos) >> MAP_OBJECT_BUCKET_SHIFT) * bucket_cols +
+         (pos_col(pos) >> MAP_OBJECT_BUCKET_SHIFT);
+}
+
+/* Count the objects of each class in the squares of the map. */
+void
+Map::init_object_index() {
+  size_t buckets = tile_count >> (2*MAP_OBJECT_BUCKET_SHIFT);
+  for (int i = 0; i < ObjectClassMax; i++) {
+    object_counts[i].assign(buckets, 0);
+  }
+
+  for (unsigned int i = 0; i < tile_count; i++) {
+    ObjectClass cls = get_object_class(get_obj(i));
+    if (cls != ObjectClassNone) object_counts[cls][get_object_bucket(i)] += 1;
+  }
+
+  object_index_valid = true;
+}
+
+/* Whether there may be objects of the class at most radius columns and
+   rows from pos. When this returns false there are none. */
+bool
+Map::has_objects_near(MapPos pos, ObjectClass cls, int radius) {
+  if (!object_index_valid) init_object_index();
+
+  int bucket_cols = cols >> MAP_OBJECT_BUCKET_SHIFT;
+  int bucket_rows = rows >> MAP_OBJECT_BUCKET_SHIFT;
+
+  /* Squares from the first to the last one that the area overlaps. */
+  int first_col = (pos_col(pos) - radius + cols) >> MAP_OBJECT_BUCKET_SHIFT;
+  int last_col = (pos_col(pos) + radius + cols) >> MAP_OBJECT_BUCKET_SHIFT;
+  int first_row = (pos_row(pos) - radius + rows) >> MAP_OBJECT_BUCKET_SHIFT;
+  int last_row = (pos_row(pos) + radius + rows) >> MAP_OBJECT_BUCKET_SHIFT;
+  int col_count = std::min(last_col - first_col + 1, bucket_cols);
+  int row_count = std::min(last_row - first_row + 1, bucket_rows);
+
+  const std::vector<uint8_t> &counts = object_counts[cls];
+  for (int r = 0; r < row_count; r++) {
+    int bucket_row = (first_row + r) % bucket_rows;
+    for (int c = 0; c < col_count; c++) {
+      int bucket_col = (first_col + c) % bucket_cols;
+      if (counts[bucket_row*bucket_cols + bucket_col] != 0) return true;
+    }
+  }
+
+  return false;
+}
+
 /* Update public parts of the map data. */
 void
 Map::update_public(MapPos pos, Random *rnd) {
@@ -654,12 +866,12 @@ void
 Map::update_hidden(MapPos pos, Random *rnd) {
   /* Update fish resources in water */
   if (is_in_water(pos) &&
-      tiles[pos].resource > 0) {
+      tile_resource[pos] > 0) {
     int r = rnd->random();
 
-    if (tiles[pos].resource < 10 && (r & 0x3f00)) {
+    if (tile_resource[pos] < 10 && (r & 0x3f00)) {
       /* Spawn more fish. */
-      tiles[pos].resource += 1;
+      tile_resource[pos] += 1;
     }
 
     /* Move in a random direction of: right, down right, left, up left */
@@ -674,8 +886,8 @@ Map::update_hidden(MapPos pos, Random *rnd) {
 
     if (is_in_water(adj_pos)) {
       /* Migrate a fish to adjacent water space. */
-      tiles[pos].resource -= 1;
-      tiles[adj_pos].resource += 1;
+      tile_resource[pos] -= 1;
+      tile_resource[adj_pos] += 1;
     }
   }
 }
@@ -758,8 +970,8 @@ Map::place_road_segments(const Road &road) {
         Direction rev_dir = *it;
         Direction dir = reverse_direction(rev_dir);
 
-        tiles[pos_].paths &= ~BIT(dir);
-        tiles[move(pos_, dir)].paths &= ~BIT(rev_dir);
+        tile_paths[pos_] &= ~BIT(dir);
+        tile_paths[move(pos_, dir)] &= ~BIT(rev_dir);
 
         pos_ = move(pos_, dir);
       }
@@ -767,10 +979,18 @@ Map::place_road_segments(const Road &road) {
       return false;
     }
 
-    tiles[pos_].paths |= BIT(*it);
-    tiles[move(pos_, *it)].paths |= BIT(rev_dir);
+    tile_paths[pos_] |= BIT(*it);
+    tile_paths[move(pos_, *it)] |= BIT(rev_dir);
+
+    pos_ = move(pos_, *it);
+  }
 
+  /* Report each tile on the road once the whole road is placed. */
+  pos_ = road.get_source();
+  notify_object_changed(pos_);
+  for (it = dirs.begin(); it != dirs.end(); ++it) {
     pos_ = move(pos_, *it);
+    notify_object_changed(pos_);
   }
 
   return true;
@@ -782,7 +1002,8 @@ Map::remove_road_backref_until_flag(MapPos pos_, Direction dir) {
     pos_ = move(pos_, dir);
 
     /* Clear backreference */
-    tiles[pos_].paths &= ~BIT(reverse_direction(dir));
+    tile_paths[pos_] &= ~BIT(reverse_direction(dir));
+    notify_object_changed(pos_);
 
     if (get_obj(pos_) == ObjectFlag) break;
 
@@ -833,11 +1054,13 @@ Map::remove_road_backrefs(MapPos pos_) {
 Direction
 Map::remove_road_segment(MapPos *pos, Direction dir) {
   /* Clear forward reference. */
-  tiles[*pos].paths &= ~BIT(dir);
+  tile_paths[*pos] &= ~BIT(dir);
+  notify_object_changed(*pos);
   *pos = move(*pos, dir);
 
   /* Clear backreference. */
-  tiles[*pos].paths &= ~BIT(reverse_direction(dir));
+  tile_paths[*pos] &= ~BIT(reverse_direction(dir));
+  notify_object_changed(*pos);
 
   /* Find next direction of path. */
   dir = DirectionNone;
@@ -926,30 +1149,31 @@ operator >> (SaveReaderBinary &reader, Map &map) {
     for (unsigned int x = 0; x < map.cols; x++) {
       MapPos pos = map.pos(x, y);
       reader >> v8;
-      map.tiles[pos].paths = v8 & 0x3f;
+      map.tile_paths[pos] = v8 & 0x3f;
       reader >> v8;
-      map.tiles[pos].height = v8;
+      map.tile_height[pos] = v8;
       reader >> v8;
-      map.tiles[pos].type = v8;
+      map.tile_type[pos] = v8;
       reader >> v8;
-      map.tiles[pos].obj = v8 & 0x7f;
+      map.tile_obj[pos] = v8 & 0x7f;
+      map.object_index_valid = false;
     }
     for (unsigned int x = 0; x < map.cols; x++) {
       MapPos pos = map.pos(x, y);
       if (map.get_obj(pos) >= Map::ObjectFlag &&
           map.get_obj(pos) <= Map::ObjectCastle) {
-        map.tiles[pos].resource = 0;
+        map.tile_resource[pos] = 0;
         reader >> v16;
-        map.tiles[pos].obj_index = v16;
+        map.tile_obj_index[pos] = v16;
       } else {
         reader >> v8;
-        map.tiles[pos].resource = v8;
+        map.tile_resource[pos] = v8;
         reader >> v8;
-        map.tiles[pos].obj_index = 0;
+        map.tile_obj_index[pos] = 0;
       }
 
       reader >> v16;
-      map.tiles[pos].serf = v16;
+      map.tile_serf[pos] = v16;
     }
   }
 
@@ -972,28 +1196,29 @@ operator >> (SaveReaderText &reader, Map &map) {
       unsigned int val;
 
       reader.value("paths")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-      map.tiles[p].paths = val & 0x3f;
+      map.tile_paths[p] = val & 0x3f;
 
       reader.value("height")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-      map.tiles[p].height = val & 0x1f;
+      map.tile_height[p] = val & 0x1f;
 
       reader.value("type.up")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-      map.tiles[p].type = ((val & 0xf) << 4) | (map.tiles[p].type & 0xf);
+      map.tile_type[p] = ((val & 0xf) << 4) | (map.tile_type[p] & 0xf);
 
       reader.value("type.down")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-      map.tiles[p].type = (map.tiles[p].type & 0xf0) | (val & 0xf);
+      map.tile_type[p] = (map.tile_type[p] & 0xf0) | (val & 0xf);
 
       reader.value("object")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-      map.tiles[p].obj = val & 0x7f;
+      map.tile_obj[p] = val & 0x7f;
+      map.object_index_valid = false;
 
       reader.value("serf")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-      map.tiles[p].serf = val;
+      map.tile_serf[p] = val;
 
       reader.value("resource.type")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-      map.tiles[p].resource = ((val & 7) << 5) | (map.tiles[p].resource & 0x1f);
+      map.tile_resource[p] = ((val & 7) << 5) | (map.tile_resource[p] & 0x1f);
 
       reader.value("resource.amount")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-      map.tiles[p].resource = (map.tiles[p].resource & 0xe0) | (val & 0x1f);
+      map.tile_resource[p] = (map.tile_resource[p] & 0xe0) | (val & 0x1f);
     }
   }
 
@@ -25,6 +25,7 @@
 #include <list>
 #include <limits>
 #include <utility>
+#include <vector>
 
 #include "src/misc.h"
 #include "src/random.h"
@@ -87,6 +88,19 @@ inline Direction reverse_direction(Direction d) {
    directly as index to map data arrays. */
 typedef unsigned int MapPos;
 const MapPos bad_map_pos = std::numeric_limits<unsigned int>::max();
+
+/* The owner of a map position is stored in two bits, which sets the
+   number of players in a game. */
+#define GAME_MAX_PLAYER_COUNT  4
+
+/* Objects are counted in squares of this many positions on each side
+   (as a power of two), see Map::has_objects_near(). */
+#define MAP_OBJECT_BUCKET_SHIFT  3
+
+/* Entries per position in the neighbour table (as a power of two,
+   enough for all eight directions), see Map::move(). */
+#define MAP_NEIGHBOUR_SHIFT  3
+
 class Map;
 
 class Road {
@@ -282,6 +296,18 @@ class Map {
     TerrainSnow1
   } Terrain;
 
+  /* Classes of objects that are counted in the object index. */
+  typedef enum ObjectClass {
+    ObjectClassTree = 0,
+    ObjectClassStone,
+    ObjectClassFlag,
+
+    ObjectClassMax,
+    ObjectClassNone = ObjectClassMax
+  } ObjectClass;
+
+  /* Receives notifications of map changes. Changes to the paths or
+     the owner of a position are reported as object changes. */
   class Handler {
    public:
     virtual void on_height_changed(MapPos pos) = 0;
@@ -289,21 +315,23 @@ class Map {
   };
 
  protected:
-  typedef struct Tile {
-    uint8_t paths;
-    uint8_t height;
-    uint8_t type;
-    uint8_t obj;
-    uint16_t obj_index;
-    uint8_t resource;
-    uint16_t serf;
-  } Tile;
-
   /* Fundamentals */
   unsigned int size;
-  Tile *tiles;
   unsigned int col_size, row_size;
 
+  /* Tile data is kept in one plane per field, indexed by MapPos, so
+     that scans over a single field of the whole map read only that
+     field. */
+  std::vector<uint8_t> tile_paths;  /* Bit 0-5: paths. */
+  std::vector<uint8_t> tile_height;  /* Bit 0-4: height, 5-6: owner,
+                                        7: has owner. */
+  std::vector<uint8_t> tile_type;  /* Bit 0-3: type down, 4-7: type up. */
+  std::vector<uint8_t> tile_obj;  /* Bit 0-6: object, 7: idle serf. */
+  std::vector<uint16_t> tile_obj_index;
+  std::vector<uint8_t> tile_resource;  /* Bit 0-4: amount, 5-7: type, or
+                                          amount of fish in water. */
+  std::vector<uint16_t> tile_serf;
+
   /* Derived */
   MapPos dirs[8];
   unsigned int tile_count;
@@ -327,6 +355,13 @@ class Map {
   change_handlers_t change_handlers;
 
   MapPos *spiral_pos_pattern;
+  MapPos *neighbours;  /* Adjacent position in each direction. */
+
+  /* Number of objects of each class in each square of
+     (1 << MAP_OBJECT_BUCKET_SHIFT) positions, by rows of squares. The
+     index is built when first used after the tiles have been replaced. */
+  std::vector<uint8_t> object_counts[ObjectClassMax];
+  bool object_index_valid;
 
  public:
   Map();
@@ -359,7 +394,7 @@ class Map {
 
   /* Movement of map position according to directions. */
   MapPos move(MapPos pos, Direction dir) const {
-    return pos_add(pos, dirs[dir]); }
+    return neighbours[(pos << MAP_NEIGHBOUR_SHIFT) | dir]; }
 
   MapPos move_right(MapPos pos) const { return move(pos, DirectionRight); }
   MapPos move_down_right(MapPos pos) const {
@@ -380,44 +415,43 @@ class Map {
     return pos_add(pos, dirs[DirectionDown]*n); }
 
   /* Extractors for map data. */
-  unsigned int paths(MapPos pos) const { return (tiles[pos].paths & 0x3f); }
+  unsigned int paths(MapPos pos) const { return (tile_paths[pos] & 0x3f); }
   bool has_path(MapPos pos, Direction dir) const {
-    return (BIT_TEST(tiles[pos].paths, dir) != 0); }
-  void add_path(MapPos pos, Direction dir) { tiles[pos].paths |= BIT(dir); }
-  void del_path(MapPos pos, Direction dir) { tiles[pos].paths &= ~BIT(dir); }
+    return (BIT_TEST(tile_paths[pos], dir) != 0); }
+  void add_path(MapPos pos, Direction dir);
+  void del_path(MapPos pos, Direction dir);
 
-  bool has_owner(MapPos pos) const { return ((tiles[pos].height >> 7) & 1); }
+  bool has_owner(MapPos pos) const { return ((tile_height[pos] >> 7) & 1); }
   unsigned int get_owner(MapPos pos) const {
-                                        return ((tiles[pos].height >> 5) & 3); }
-  void set_owner(MapPos pos, unsigned int player) {
-    tiles[pos].height = (1 << 7) | (player << 5) | get_height(pos); }
-  void del_owner(MapPos pos) { tiles[pos].height &= 0x1f; }
+                                        return ((tile_height[pos] >> 5) & 3); }
+  void set_owner(MapPos pos, unsigned int player);
+  void del_owner(MapPos pos);
   unsigned int get_height(MapPos pos) const {
-    return (tiles[pos].height & 0x1f); }
+    return (tile_height[pos] & 0x1f); }
 
   Terrain type_up(MapPos pos) const {
-    return static_cast<Terrain>(((tiles[pos].type >> 4) & 0xf)); }
+    return static_cast<Terrain>(((tile_type[pos] >> 4) & 0xf)); }
   Terrain type_down(MapPos pos) const {
-    return static_cast<Terrain>(tiles[pos].type & 0xf); }
+    return static_cast<Terrain>(tile_type[pos] & 0xf); }
   bool types_within(MapPos pos, Terrain low, Terrain high);
 
   Object get_obj(MapPos pos) const {
-    return (Object)(tiles[pos].obj & 0x7f); }
+    return (Object)(tile_obj[pos] & 0x7f); }
   unsigned int get_idle_serf(MapPos pos) const {
-    return ((tiles[pos].obj >> 7) & 1); }
-  void set_idle_serf(MapPos pos) { tiles[pos].obj |= BIT(7); }
-  void clear_idle_serf(MapPos pos) { tiles[pos].obj &= ~BIT(7); }
+    return ((tile_obj[pos] >> 7) & 1); }
+  void set_idle_serf(MapPos pos) { tile_obj[pos] |= BIT(7); }
+  void clear_idle_serf(MapPos pos) { tile_obj[pos] &= ~BIT(7); }
 
   unsigned int get_obj_index(MapPos pos) const {
-    return tiles[pos].obj_index; }
+    return tile_obj_index[pos]; }
   void set_obj_index(MapPos pos, unsigned int index) {
-    tiles[pos].obj_index = index; }
+    tile_obj_index[pos] = index; }
   Minerals get_res_type(MapPos pos) const {
-    return (Minerals)((tiles[pos].resource >> 5) & 7); }
+    return (Minerals)((tile_resource[pos] >> 5) & 7); }
   unsigned int get_res_amount(MapPos pos) const {
-    return (tiles[pos].resource & 0x1f); }
-  unsigned int get_res_fish(MapPos pos) const { return tiles[pos].resource; }
-  unsigned int get_serf_index(MapPos pos) const { return tiles[pos].serf; }
+    return (tile_resource[pos] & 0x1f); }
+  unsigned int get_res_fish(MapPos pos) const { return tile_resource[pos]; }
+  unsigned int get_serf_index(MapPos pos) const { return tile_serf[pos]; }
 
   bool has_flag(MapPos pos) const { return (get_obj(pos) == ObjectFlag); }
   bool has_building(MapPos pos) const { return (get_obj(pos) >=
@@ -437,6 +471,17 @@ class Map {
             type_down(move_left(pos)) <= TerrainWater3 &&
             type_up(move_up(pos)) <= TerrainWater3); }
 
+  /* Whole map scans. The find functions return the first position
+     at or after pos (in MapPos order, i.e. row by row) with the
+     property, or bad_map_pos if there is none. */
+  void get_owned_tile_counts(unsigned int counts[GAME_MAX_PLAYER_COUNT]) const;
+  MapPos find_next_owned(MapPos pos) const {
+    return find_next_in_plane(tile_height, pos, BIT(7)); }
+  MapPos find_next_path(MapPos pos) const {
+    return find_next_in_plane(tile_paths, pos, 0x3f); }
+  MapPos find_next_idle_serf(MapPos pos) const {
+    return find_next_in_plane(tile_obj, pos, BIT(7)); }
+
   /* Mapping from Object to Space. */
   static const Space map_space_from_obj[128];
 
@@ -461,6 +506,10 @@ class Map {
   void del_change_handler(Handler *handler);
 
   static int *get_spiral_pattern();
+  static int get_spiral_radius(unsigned int index);
+
+  static ObjectClass get_object_class(Object obj);
+  bool has_objects_near(MapPos pos, ObjectClass cls, int radius);
 
   /* Actually place road segments */
   bool place_road_segments(const Road &road);
@@ -479,9 +528,15 @@ class Map {
 
  protected:
   void init_minimap();
+  void notify_object_changed(MapPos pos);
 
   void init_ground_gold_deposit();
   void init_spiral_pos_pattern();
+  void init_neighbours();
+  MapPos find_next_in_plane(const std::vector<uint8_t> &plane, MapPos pos,
+                            uint8_t mask) const;
+  void init_object_index();
+  size_t get_object_bucket(MapPos pos) const;
 
   void update_public(MapPos pos, Random *rnd);
   void update_hidden(MapPos pos, Random *rnd);
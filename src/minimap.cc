@@ -74,27 +74,19 @@ Minimap::draw_minimap_map() {
 
 void
 MinimapGame::draw_minimap_ownership(int density) {
-  for (unsigned int row = 0; row < map->get_rows(); row++) {
-    for (unsigned int col = 0; col < map->get_cols(); col++) {
-      MapPos pos = map->pos(col, row);
-      if (map->has_owner(pos)) {
-        int color =
-            interface->get_game()->get_player(map->get_owner(pos))->get_color();
-        draw_minimap_point(col, row, color, density);
-      }
-    }
+  for (MapPos pos = map->find_next_owned(0); pos != bad_map_pos;
+       pos = map->find_next_owned(pos + 1)) {
+    int color =
+        interface->get_game()->get_player(map->get_owner(pos))->get_color();
+    draw_minimap_point(map->pos_col(pos), map->pos_row(pos), color, density);
   }
 }
 
 void
 MinimapGame::draw_minimap_roads() {
-  for (unsigned int row = 0; row < map->get_rows(); row++) {
-    for (unsigned int col = 0; col < map->get_cols(); col++) {
-      int pos = map->pos(col, row);
-      if (map->paths(pos)) {
-        draw_minimap_point(col, row, 1, scale);
-      }
-    }
+  for (MapPos pos = map->find_next_path(0); pos != bad_map_pos;
+       pos = map->find_next_path(pos + 1)) {
+    draw_minimap_point(map->pos_col(pos), map->pos_row(pos), 1, scale);
   }
 }
 
@@ -135,15 +127,11 @@ MinimapGame::draw_minimap_buildings() {
 
 void
 MinimapGame::draw_minimap_traffic() {
-  for (unsigned int row = 0; row < map->get_rows(); row++) {
-    for (unsigned int col = 0; col < map->get_cols(); col++) {
-      int pos = map->pos(col, row);
-      if (map->get_idle_serf(pos)) {
-        int color =
-            interface->get_game()->get_player(map->get_owner(pos))->get_color();
-        draw_minimap_point(col, row, color, scale);
-      }
-    }
+  for (MapPos pos = map->find_next_idle_serf(0); pos != bad_map_pos;
+       pos = map->find_next_idle_serf(pos + 1)) {
+    int color =
+        interface->get_game()->get_player(map->get_owner(pos))->get_color();
+    draw_minimap_point(map->pos_col(pos), map->pos_row(pos), color, scale);
   }
 }
 
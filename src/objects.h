@@ -22,10 +22,21 @@
 #ifndef SRC_OBJECTS_H_
 #define SRC_OBJECTS_H_
 
-#include <map>
+#include <vector>
 #include <algorithm>
-#include <set>
 #include <climits>
+#include <new>
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+
+/* Number of objects in each block of object storage. */
+#define COLLECTION_BLOCK_SIZE  256
 
 class Game;
 
@@ -42,71 +53,93 @@ class GameObject {
   unsigned int get_index() const { return index; }
 };
 
+/* Return the position of the lowest set bit in a non-zero word. */
+inline unsigned int
+lowest_bit(uint64_t bits) {
+#ifdef __GNUC__
+  return __builtin_ctzll(bits);
+#else
+  unsigned int n = 0;
+  while ((bits & 1) == 0) {
+    bits >>= 1;
+    n += 1;
+  }
+  return n;
+#endif
+}
+
+/* Objects are kept in a vector addressed by object index. A bitmap
+   records which slots are in use; it is used to skip free slots when
+   iterating and to find the lowest free index on allocation. Lowest
+   free index first is the order the game has always used, and it
+   determines the order in which objects are updated.
+
+   The objects themselves are constructed in blocks of storage owned
+   by the collection. Storage of erased objects is reused for new
+   objects, and clear() makes all storage available again without
+   returning it to the heap. */
 template<class T>
 class Collection {
  protected:
-  typedef std::map<unsigned int, T*> Objects;
+  typedef std::vector<T*> Objects;
+  typedef std::vector<uint64_t> Bitmap;
 
   Objects objects;
-  unsigned int last_object_index;
-  std::set<unsigned int> free_object_indexes;
+  Bitmap occupied;
+  unsigned int first_free;
+  size_t count;
   Game *game;
 
+  std::vector<void*> blocks;
+  std::vector<void*> free_storage;
+  size_t current_block;
+  size_t block_used;
+  size_t high_water_mark;
+
  public:
   explicit Collection(Game *game) {
     this->game = game;
-    last_object_index = 0;
+    first_free = 0;
+    count = 0;
+    current_block = 0;
+    block_used = 0;
+    high_water_mark = 0;
+  }
+
+  ~Collection() {
+    clear();
+    for (size_t i = 0; i < blocks.size(); i++) {
+      ::operator delete(blocks[i]);
+    }
   }
 
   T*
   allocate() {
-    unsigned int new_index = 0;
-
-    if (!free_object_indexes.empty()) {
-      new_index = *free_object_indexes.begin();
-      free_object_indexes.erase(free_object_indexes.begin());
-    } else {
-      if (last_object_index == UINT_MAX) {
-        return NULL;
-      }
-
-      new_index = last_object_index;
-      last_object_index++;
+    unsigned int new_index = find_slot(first_free, false);
+    if (new_index == UINT_MAX) {
+      return NULL;
     }
 
-    T *new_object = new T(game, new_index);
-    objects[new_index] = new_object;
+    T *new_object = new(get_storage()) T(game, new_index);
+    insert(new_index, new_object);
+    first_free = new_index + 1;
 
     return new_object;
   }
 
   bool
   exists(unsigned int index) {
-    return (objects.end() != objects.find(index));
+    return (index < objects.size() && objects[index] != NULL);
   }
 
   T*
   get_or_insert(unsigned int index) {
-    T *object = NULL;
-
     if (exists(index)) {
-      object = objects[index];
-    } else {
-      object = new T(game, index);
-      objects[index] = object;
-
-      std::set<unsigned int>::iterator i = free_object_indexes.find(index);
-      if (i != free_object_indexes.end()) {
-        free_object_indexes.erase(i);
-      }
+      return objects[index];
     }
 
-    if (last_object_index <= index) {
-      for (unsigned int i = last_object_index; i < index; i++) {
-        free_object_indexes.insert(index);
-      }
-      last_object_index = index + 1;
-    }
+    T *object = new(get_storage()) T(game, index);
+    insert(index, object);
 
     return object;
   }
@@ -121,22 +154,27 @@ class Collection {
 
   class Iterator {
    protected:
-    typename Objects::iterator internal_iterator;
+    Collection *collection;
+    unsigned int index;
 
    public:
-    explicit Iterator(typename Objects::iterator internal_iterator) {
-      this->internal_iterator = internal_iterator;
+    Iterator(Collection *collection, unsigned int index) {
+      this->collection = collection;
+      this->index = index;
     }
 
     Iterator&
     operator++() {
-      internal_iterator++;
+      index += 1;
+      if (!collection->exists(index)) {
+        index = collection->find_slot(index, true);
+      }
       return (*this);
     }
 
     bool
     operator==(const Iterator& right) const {
-      return (internal_iterator == right.internal_iterator);
+      return (index == right.index);
     }
 
     bool
@@ -146,41 +184,279 @@ class Collection {
 
     T*
     operator*() const {
-      return internal_iterator->second;
+      return collection->objects[index];
     }
   };
 
   Iterator
   begin() {
-    return Iterator(objects.begin());
+    return Iterator(this, find_slot(0, true));
   }
 
   Iterator
   end() {
-    return Iterator(objects.end());
+    return Iterator(this, static_cast<unsigned int>(objects.size()));
+  }
+
+  /* Set of object indexes, e.g. the objects owned by one player. It is
+     kept by the user of the collection and must only contain indexes
+     of existing objects. Like the collection it is a bitmap, so the
+     members are visited in index order. */
+  class Subset {
+   protected:
+    Bitmap bits;
+    size_t count;
+
+   public:
+    Subset() : count(0) {}
+
+    void
+    insert(unsigned int index) {
+      if (contains(index)) return;
+      if (index / 64 >= bits.size()) {
+        bits.resize(index / 64 + 1, 0);
+      }
+      bits[index / 64] |= static_cast<uint64_t>(1) << (index % 64);
+      count += 1;
+    }
+
+    void
+    erase(unsigned int index) {
+      if (!contains(index)) return;
+      bits[index / 64] &= ~(static_cast<uint64_t>(1) << (index % 64));
+      count -= 1;
+    }
+
+    bool
+    contains(unsigned int index) const {
+      return (index / 64 < bits.size() &&
+              ((bits[index / 64] >> (index % 64)) & 1) != 0);
+    }
+
+    void
+    clear() {
+      bits.clear();
+      count = 0;
+    }
+
+    size_t size() const { return count; }
+
+    /* Return the members with indexes word*64 to word*64+63 as bits. */
+    uint64_t
+    get_bits(size_t word) const {
+      return (word < bits.size()) ? bits[word] : 0;
+    }
+
+    /* Return the first member from start, or UINT_MAX if none is left. */
+    unsigned int
+    next(unsigned int start) const {
+      size_t word = start / 64;
+      uint64_t skip = (static_cast<uint64_t>(1) << (start % 64)) - 1;
+
+      for (; word < bits.size(); word++) {
+        uint64_t b = bits[word] & ~skip;
+        skip = 0;
+        if (b != 0) {
+          return static_cast<unsigned int>(word * 64) + lowest_bit(b);
+        }
+      }
+
+      return UINT_MAX;
+    }
+  };
+
+  /* The objects of a subset. The view refers to the subset, so it
+     reflects later changes to it and must not outlive it. */
+  class View {
+   protected:
+    Collection *collection;
+    const Subset *subset;
+
+   public:
+    class Iterator {
+     protected:
+      Collection *collection;
+      const Subset *subset;
+      unsigned int index;
+
+     public:
+      Iterator(Collection *collection, const Subset *subset,
+               unsigned int index) {
+        this->collection = collection;
+        this->subset = subset;
+        this->index = index;
+      }
+
+      Iterator&
+      operator++() {
+        index = subset->next(index + 1);
+        return (*this);
+      }
+
+      bool
+      operator==(const Iterator& right) const {
+        return (index == right.index);
+      }
+
+      bool
+      operator!=(const Iterator& right) const {
+        return (!(*this == right));
+      }
+
+      T*
+      operator*() const {
+        return collection->objects[index];
+      }
+    };
+
+    typedef Iterator iterator;
+
+    View(Collection *collection, const Subset *subset) {
+      this->collection = collection;
+      this->subset = subset;
+    }
+
+    Iterator
+    begin() const {
+      return Iterator(collection, subset, subset->next(0));
+    }
+
+    Iterator
+    end() const {
+      return Iterator(collection, subset, UINT_MAX);
+    }
+
+    size_t size() const { return subset->size(); }
+    bool empty() const { return (subset->size() == 0); }
+  };
+
+  View
+  get_view(const Subset &subset) {
+    return View(this, &subset);
+  }
+
+  /* Return the first index from start that is in use and not a member
+     of excluded, or UINT_MAX if none is left. */
+  unsigned int
+  next_excluding(unsigned int start, const Subset &excluded) const {
+    size_t word = start / 64;
+    uint64_t skip = (static_cast<uint64_t>(1) << (start % 64)) - 1;
+
+    for (; word < occupied.size(); word++) {
+      uint64_t bits = occupied[word] & ~excluded.get_bits(word) & ~skip;
+      skip = 0;
+      if (bits != 0) {
+        return static_cast<unsigned int>(word * 64) + lowest_bit(bits);
+      }
+    }
+
+    return UINT_MAX;
   }
 
   void
   erase(unsigned int index) {
-    /* Decrement max_flag_index as much as possible. */
-    typename Objects::iterator i = objects.find(index);
-    if (i == objects.end()) {
+    if (!exists(index)) {
       return;
     }
-    T *object = i->second;
-    objects.erase(i);
-    delete object;
+    T *object = objects[index];
+    objects[index] = NULL;
+    occupied[index / 64] &= ~(static_cast<uint64_t>(1) << (index % 64));
+    count -= 1;
+    object->~T();
+    free_storage.push_back(object);
+
+    if (index < first_free) {
+      first_free = index;
+    }
+  }
 
-    if (index == last_object_index) {
-      last_object_index--;
-      // ToDo: remove all empty indexes if needed
-    } else {
-      free_object_indexes.insert(index);
+  /* Destroy all objects and make all storage available for reuse. */
+  void
+  clear() {
+    for (size_t i = 0; i < objects.size(); i++) {
+      if (objects[i] != NULL) objects[i]->~T();
     }
+
+    objects.clear();
+    occupied.clear();
+    free_storage.clear();
+    first_free = 0;
+    count = 0;
+    current_block = 0;
+    block_used = 0;
   }
 
   size_t
-  size() { return objects.size(); }
+  size() { return count; }
+
+  /* Largest number of objects that have existed at the same time. */
+  size_t get_high_water_mark() const { return high_water_mark; }
+  size_t get_storage_size() const {
+    return blocks.size() * COLLECTION_BLOCK_SIZE * sizeof(T); }
+
+ protected:
+  void
+  insert(unsigned int index, T *object) {
+    if (index >= objects.size()) {
+      objects.resize(index + 1, NULL);
+      occupied.resize(index / 64 + 1, 0);
+    }
+    objects[index] = object;
+    occupied[index / 64] |= static_cast<uint64_t>(1) << (index % 64);
+    count += 1;
+    high_water_mark = std::max(high_water_mark, count);
+  }
+
+  /* Return storage for one object, preferring storage of erased objects
+     and otherwise taking the next slot of the current block. */
+  void *
+  get_storage() {
+    if (!free_storage.empty()) {
+      void *storage = free_storage.back();
+      free_storage.pop_back();
+      return storage;
+    }
+
+    if (block_used == COLLECTION_BLOCK_SIZE) {
+      current_block += 1;
+      block_used = 0;
+    }
+    if (current_block == blocks.size()) {
+      blocks.push_back(::operator new(COLLECTION_BLOCK_SIZE * sizeof(T)));
+    }
+
+    char *block = static_cast<char*>(blocks[current_block]);
+    return block + sizeof(T) * block_used++;
+  }
+
+  /* Return the first index from start that is in use (or free if
+     used is false). When no used slot is left, the number of slots
+     is returned, which is the index of end(). When no free slot is
+     left, the first index past the slots is returned. */
+  unsigned int
+  find_slot(unsigned int start, bool used) const {
+    size_t word = start / 64;
+    uint64_t skip = (static_cast<uint64_t>(1) << (start % 64)) - 1;
+
+    for (; word < occupied.size(); word++) {
+      uint64_t bits = used ? occupied[word] & ~skip : ~(occupied[word] | skip);
+      skip = 0;
+      if (bits == 0) continue;
+
+      unsigned int index = static_cast<unsigned int>(word * 64) +
+                           lowest_bit(bits);
+
+      if (index >= objects.size()) break;
+      return index;
+    }
+
+    if (!used && objects.size() < UINT_MAX) {
+      return static_cast<unsigned int>(std::max(static_cast<size_t>(start),
+                                                objects.size()));
+    }
+
+    return static_cast<unsigned int>(objects.size());
+  }
 };
 
 #endif  // SRC_OBJECTS_H_
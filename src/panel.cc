@@ -392,19 +392,19 @@ PanelBar::button_type_with_build_possibility(int build_possibility) {
   Button result;
 
   switch (build_possibility) {
-    case Interface::BuildPossibilityCastle:
+    case Game::BuildPossibilityCastle:
       result = ButtonBuildCastle;
       break;
-    case Interface::BuildPossibilityMine:
+    case Game::BuildPossibilityMine:
       result = ButtonBuildMine;
       break;
-    case Interface::BuildPossibilityLarge:
+    case Game::BuildPossibilityLarge:
       result = ButtonBuildLarge;
       break;
-    case Interface::BuildPossibilitySmall:
+    case Game::BuildPossibilitySmall:
       result = ButtonBuildSmall;
       break;
-    case Interface::BuildPossibilityFlag:
+    case Game::BuildPossibilityFlag:
       result = ButtonBuildFlag;
       break;
     default:
@@ -450,7 +450,7 @@ PanelBar::update() {
     panel_btns[3] = ButtonStats;
     panel_btns[4] = ButtonSett;
 
-    Interface::BuildPossibility build_possibility =
+    Game::BuildPossibility build_possibility =
                                              interface->get_build_possibility();
 
     switch (interface->get_map_cursor_type()) {
@@ -477,13 +477,13 @@ PanelBar::update() {
       case Interface::CursorTypePath:
         panel_btns[0] = ButtonBuildInactive;
         panel_btns[1] = ButtonDestroyRoad;
-        if (build_possibility != Interface::BuildPossibilityNone) {
+        if (build_possibility != Game::BuildPossibilityNone) {
           panel_btns[0] = ButtonBuildFlag;
         }
         break;
       case Interface::CursorTypeClearByFlag:
-        if (build_possibility == Interface::BuildPossibilityNone ||
-            build_possibility == Interface::BuildPossibilityFlag) {
+        if (build_possibility == Game::BuildPossibilityNone ||
+            build_possibility == Game::BuildPossibilityFlag) {
           panel_btns[0] = ButtonBuildInactive;
           if (interface->get_player()->has_castle()) {
             panel_btns[1] = ButtonDestroyInactive;
@@ -22,38 +22,99 @@
 #include "src/pathfinder.h"
 
 #include <cstdlib>
-#include <list>
+#include <climits>
 #include <vector>
+#include <queue>
+#include <functional>
+#include <utility>
 #include <algorithm>
 
-#include "src/smart_ptr.h"
+#include "src/debug.h"
 
-class SearchNode;
-
-typedef SmartPtr<SearchNode> PSearchNode;
-
-class SearchNode {
- public:
-  MapPos pos;
+/* Search state of one map position. The entry belongs to the current
+   search only if generation matches the generation of the search. */
+typedef struct SearchNode {
+  uint32_t generation;
   unsigned int g_score;
   unsigned int f_score;
-  PSearchNode parent;
+  bool closed;
+  MapPos parent;
   Direction dir;
+} SearchNode;
+
+/* Orders map positions for the open heap by the f-score of their
+   nodes. A node is considered less than the other if it has a larger
+   f-score. This means that in the max-heap the lower score will go to
+   the top. */
+class SearchNodeLess {
+ protected:
+  const std::vector<SearchNode> *nodes;
+
+ public:
+  explicit SearchNodeLess(const std::vector<SearchNode> *nodes)
+    : nodes(nodes) {}
+
+  bool operator()(MapPos left, MapPos right) const {
+    return (*nodes)[left].f_score > (*nodes)[right].f_score;
+  }
 };
 
-static bool
-search_node_less(const PSearchNode &left, const PSearchNode &right) {
-  // A search node is considered less than the other if
-  // it has a larger f-score. This means that in the max-heap
-  // the lower score will go to the top.
-  return left->f_score > right->f_score;
-}
+/* Search state that is kept between searches. The node array is
+   indexed by map position, so nodes and their open/closed state are
+   found without any lookup. The node array is never cleared; bumping the
+   generation invalidates all entries at once. */
+class SearchContext {
+ protected:
+  std::vector<SearchNode> nodes;
+  std::vector<MapPos> open;
+  uint32_t generation;
+
+ public:
+  SearchContext() : generation(0) {}
+
+  /* Start a new search on map. */
+  void
+  begin(Map *map) {
+    size_t tile_count = map->get_cols() * map->get_rows();
+    if (nodes.size() != tile_count) {
+      nodes.clear();
+      nodes.resize(tile_count, SearchNode());
+      generation = 0;
+    }
+
+    generation += 1;
+    if (generation == 0) {
+      /* Wrapped around, old entries could be mistaken as current. */
+      for (size_t i = 0; i < nodes.size(); i++) nodes[i].generation = 0;
+      generation = 1;
+    }
+
+    open.clear();
+  }
+
+  SearchNode *get(MapPos pos) { return &nodes[pos]; }
+  bool is_visited(MapPos pos) const {
+    return (nodes[pos].generation == generation); }
+
+  /* Start tracking pos in the current search. */
+  SearchNode *
+  visit(MapPos pos) {
+    SearchNode *node = &nodes[pos];
+    node->generation = generation;
+    node->closed = false;
+    return node;
+  }
+
+  /* Open list as a heap ordered by SearchNodeLess. */
+  std::vector<MapPos> &get_open() { return open; }
+  SearchNodeLess get_less() const { return SearchNodeLess(&nodes); }
+};
 
 static const unsigned int walk_cost[] = { 255, 319, 383, 447, 511 };
 
-static unsigned int
-heuristic_cost(Map *map, MapPos start, MapPos end) {
-  /* Calculate distance to target. */
+/* Number of steps between two positions, ignoring obstacles. */
+static int
+get_distance(Map *map, MapPos start, MapPos end) {
   int dist_col = (map->pos_col(start) - map->pos_col(end)) &
                  map->get_col_mask();
   if (dist_col >= static_cast<int>(map->get_cols()/2.0)) {
@@ -66,17 +127,21 @@ heuristic_cost(Map *map, MapPos start, MapPos end) {
     dist_row -= map->get_rows();
   }
 
-  int h_diff = abs(static_cast<int>(map->get_height(start)) -
-                   static_cast<int>(map->get_height(end)));
-  int dist = 0;
-
   if ((dist_col > 0 && dist_row > 0) ||
       (dist_col < 0 && dist_row < 0)) {
-    dist = std::max(abs(dist_col), abs(dist_row));
-  } else {
-    dist = abs(dist_col) + abs(dist_row);
+    return std::max(abs(dist_col), abs(dist_row));
   }
 
+  return abs(dist_col) + abs(dist_row);
+}
+
+static unsigned int
+heuristic_cost(Map *map, MapPos start, MapPos end) {
+  /* Calculate distance to target. */
+  int dist = get_distance(map, start, end);
+  int h_diff = abs(static_cast<int>(map->get_height(start)) -
+                   static_cast<int>(map->get_height(end)));
+
   return dist > 0 ? dist*walk_cost[h_diff/dist] : 0;
 }
 
@@ -88,111 +153,568 @@ actual_cost(Map *map, MapPos pos, Direction dir) {
   return walk_cost[h_diff];
 }
 
-/* Find the shortest path from start to end (using A*) considering that
-   the walking time for a serf walking in any direction of the path
-   should be minimized. Returns a malloc'ed array of directions and
-   the size of this array in length. */
-Road
-pathfinder_map(Map *map, MapPos start, MapPos end) {
+/* Index of the road planner cluster that contains pos. */
+static unsigned int
+get_cluster_index(Map *map, MapPos pos) {
+  unsigned int cluster_cols = map->get_cols() >> ROAD_PLANNER_CLUSTER_SHIFT;
+  return (map->pos_row(pos) >> ROAD_PLANNER_CLUSTER_SHIFT) * cluster_cols +
+         (map->pos_col(pos) >> ROAD_PLANNER_CLUSTER_SHIFT);
+}
+
+/* A* search for a road from start to end. If corridor is not NULL the
+   road only passes through the clusters that are set in it. */
+static Road
+search_road(Map *map, MapPos start, MapPos end,
+            const std::vector<bool> *corridor) {
+  static SearchContext context;
+  context.begin(map);
+  std::vector<MapPos> &open = context.get_open();
+  SearchNodeLess less = context.get_less();
+
   // Unfortunately the STL priority_queue cannot be used since we
-  // would need access to the underlying sequence to determine if
-  // a node is already in the open list. We keep instead open as
-  // a vector and apply std::pop_heap and std::push_heap to keep
-  // it heapified.
-  std::vector<PSearchNode> open;
-  std::list<PSearchNode> closed;
+  // would need access to the underlying sequence to reorder it when
+  // the score of a node in the open list improves. We keep instead
+  // open as a vector and apply std::pop_heap and std::push_heap to
+  // keep it heapified. The order of nodes with equal scores depends
+  // on these operations, so they are kept as they were to always
+  // find the same road.
 
   /* Create start node */
-  PSearchNode node(new SearchNode);
-  node->pos = end;
+  SearchNode *node = context.visit(end);
   node->g_score = 0;
   node->f_score = heuristic_cost(map, start, end);
+  node->parent = bad_map_pos;
 
-  open.push_back(node);
+  open.push_back(end);
 
   while (!open.empty()) {
-    std::pop_heap(open.begin(), open.end(), search_node_less);
-    node = open.back();
+    std::pop_heap(open.begin(), open.end(), less);
+    MapPos pos = open.back();
     open.pop_back();
+    node = context.get(pos);
 
-    if (node->pos == start) {
+    if (pos == start) {
       /* Construct solution */
       Road solution;
       solution.start(start);
 
-      std::list<Direction> dirs;
-      while (node->parent != NULL) {
-        Direction dir = node->dir;
-        solution.extend(reverse_direction(dir));
-        node = node->parent;
+      while (node->parent != bad_map_pos) {
+        solution.extend(reverse_direction(node->dir));
+        node = context.get(node->parent);
       }
 
       return solution;
     }
 
     /* Put current node on closed list. */
-    closed.push_front(node);
+    node->closed = true;
 
     for (int d = DirectionRight; d <= DirectionUp; d++) {
-      MapPos new_pos = map->move(node->pos, (Direction)d);
-      unsigned int cost = actual_cost(map, node->pos,
-                                      static_cast<Direction>(d));
+      MapPos new_pos = map->move(pos, (Direction)d);
+      unsigned int cost = actual_cost(map, pos, static_cast<Direction>(d));
 
       /* Check if neighbour is valid. */
-      if (!map->is_road_segment_valid(node->pos, static_cast<Direction>(d)) ||
+      if (!map->is_road_segment_valid(pos, static_cast<Direction>(d)) ||
           (map->get_obj(new_pos) == Map::ObjectFlag && new_pos != start)) {
         continue;
       }
 
-      /* Check if neighbour is in closed list. */
-      bool in_closed = false;
-      for (std::list<PSearchNode>::iterator it = closed.begin();
-           it != closed.end(); ++it) {
-        if ((*it)->pos == new_pos) {
-          in_closed = true;
-          break;
-        }
+      if (corridor != NULL && !(*corridor)[get_cluster_index(map, new_pos)]) {
+        continue;
       }
 
-      if (in_closed) continue;
-
-      /* See if neighbour is already in open list. */
-      bool in_open = false;
-      for (std::vector<PSearchNode>::iterator it = open.begin();
-           it != open.end(); ++it) {
-        PSearchNode n = *it;
-        if (n->pos == new_pos) {
-          in_open = true;
-          if (n->g_score >= node->g_score + cost) {
-            n->g_score = node->g_score + cost;
-            n->f_score = n->g_score + heuristic_cost(map, new_pos, start);
-            n->parent = node;
-            n->dir = static_cast<Direction>(d);
-
-            // Move element to the back and heapify
-            iter_swap(it, open.rbegin());
-            std::make_heap(open.begin(), open.end(), search_node_less);
-          }
-          break;
-        }
-      }
+      if (context.is_visited(new_pos)) {
+        SearchNode *n = context.get(new_pos);
+
+        /* Neighbour is in closed list. */
+        if (n->closed) continue;
 
-      /* If not found in the open set, create a new node. */
-      if (!in_open) {
-        PSearchNode new_node(new SearchNode);
+        /* Neighbour is in open list. */
+        if (n->g_score >= node->g_score + cost) {
+          n->g_score = node->g_score + cost;
+          n->f_score = n->g_score + heuristic_cost(map, new_pos, start);
+          n->parent = pos;
+          n->dir = static_cast<Direction>(d);
 
-        new_node->pos = new_pos;
+          // Move element to the back and heapify
+          std::vector<MapPos>::iterator it = std::find(open.begin(),
+                                                       open.end(), new_pos);
+          iter_swap(it, open.rbegin());
+          std::make_heap(open.begin(), open.end(), less);
+        }
+      } else {
+        /* Not found in the open set, create a new node. */
+        SearchNode *new_node = context.visit(new_pos);
         new_node->g_score = node->g_score + cost;
         new_node->f_score = new_node->g_score +
                             heuristic_cost(map, new_pos, start);
-        new_node->parent = node;
+        new_node->parent = pos;
         new_node->dir = static_cast<Direction>(d);
 
-        open.push_back(new_node);
-        std::push_heap(open.begin(), open.end(), search_node_less);
+        open.push_back(new_pos);
+        std::push_heap(open.begin(), open.end(), less);
       }
     }
   }
 
   return Road();
 }
+
+/* Find the shortest path from start to end (using A*) considering that
+   the walking time for a serf walking in any direction of the path
+   should be minimized. Returns the road from start to end, or an
+   invalid road if there is none. */
+Road
+pathfinder_map(Map *map, MapPos start, MapPos end) {
+  return search_road(map, start, end, NULL);
+}
+
+#define ROAD_PLANNER_CLUSTER_SIZE  (1 << ROAD_PLANNER_CLUSTER_SHIFT)
+
+/* Longest run of neighbouring border crossings served by one entrance. */
+#define ROAD_PLANNER_MAX_ENTRANCE  6
+
+#define ROAD_PLANNER_NONE  UINT_MAX
+
+/* Directions to the neighbours whose borders a cluster owns. */
+static const Direction border_dir[] = {
+  DirectionRight, DirectionDownRight, DirectionDown
+};
+
+RoadPlanner::RoadPlanner(Map *map) : map(map) {
+  cluster_cols = map->get_cols() >> ROAD_PLANNER_CLUSTER_SHIFT;
+  cluster_rows = map->get_rows() >> ROAD_PLANNER_CLUSTER_SHIFT;
+
+  Cluster cluster;
+  for (int k = 0; k < 3; k++) cluster.border_valid[k] = false;
+  cluster.edges_valid = false;
+  clusters.resize(cluster_cols * cluster_rows, cluster);
+
+  generation = 0;
+  local_dist.resize(ROAD_PLANNER_CLUSTER_SIZE * ROAD_PLANNER_CLUSTER_SIZE);
+
+  map->add_change_handler(this);
+}
+
+RoadPlanner::~RoadPlanner() {
+  map->del_change_handler(this);
+}
+
+/* Find a road from start to end, see pathfinder_map(). Roads within
+   about two clusters are always searched directly. */
+Road
+RoadPlanner::find_road(MapPos start, MapPos end) {
+  if (get_distance(map, start, end) < 2 * ROAD_PLANNER_CLUSTER_SIZE) {
+    return pathfinder_map(map, start, end);
+  }
+
+  std::vector<bool> corridor;
+  if (find_abstract_path(start, end, &corridor)) {
+    Road road = search_road(map, start, end, &corridor);
+    if (road.is_valid()) return road;
+  }
+
+  return pathfinder_map(map, start, end);
+}
+
+void
+RoadPlanner::on_height_changed(MapPos pos) {
+  invalidate(pos);
+}
+
+void
+RoadPlanner::on_object_changed(MapPos pos) {
+  invalidate(pos);
+}
+
+unsigned int
+RoadPlanner::get_cluster(MapPos pos) const {
+  return get_cluster_index(map, pos);
+}
+
+unsigned int
+RoadPlanner::get_neighbour(unsigned int cluster, Direction dir) const {
+  int col = cluster % cluster_cols;
+  int row = cluster / cluster_cols;
+
+  switch (dir) {
+    case DirectionRight: col += 1; break;
+    case DirectionDownRight: col += 1; row += 1; break;
+    case DirectionDown: row += 1; break;
+    case DirectionLeft: col -= 1; break;
+    case DirectionUpLeft: col -= 1; row -= 1; break;
+    case DirectionUp: row -= 1; break;
+    default: NOT_REACHED(); break;
+  }
+
+  col = (col + cluster_cols) % cluster_cols;
+  row = (row + cluster_rows) % cluster_rows;
+  return row * cluster_cols + col;
+}
+
+/* Mark the borders around the cluster of pos for rebuilding. The edges
+   of the clusters follow when the borders are rebuilt. */
+void
+RoadPlanner::invalidate(MapPos pos) {
+  unsigned int cluster = get_cluster(pos);
+
+  for (int k = 0; k < 3; k++) {
+    clusters[cluster].border_valid[k] = false;
+    Direction dir = reverse_direction(border_dir[k]);
+    clusters[get_neighbour(cluster, dir)].border_valid[k] = false;
+  }
+  clusters[cluster].edges_valid = false;
+}
+
+/* Make sure that the entrances and edges of cluster are up to date. */
+void
+RoadPlanner::ensure_cluster(unsigned int cluster) {
+  for (int k = 0; k < 3; k++) {
+    if (!clusters[cluster].border_valid[k]) build_border(cluster, k);
+
+    Direction dir = reverse_direction(border_dir[k]);
+    unsigned int other = get_neighbour(cluster, dir);
+    if (!clusters[other].border_valid[k]) build_border(other, k);
+  }
+
+  if (!clusters[cluster].edges_valid) build_edges(cluster);
+}
+
+void
+RoadPlanner::build_border(unsigned int cluster, int border) {
+  std::vector<unsigned int> *list = &clusters[cluster].border_nodes[border];
+  for (size_t i = 0; i < list->size(); i++) {
+    free_node((*list)[i]);
+  }
+  list->clear();
+
+  unsigned int other = get_neighbour(cluster, border_dir[border]);
+  add_crossings(cluster, other, border_dir[border], list);
+  add_crossings(other, cluster, reverse_direction(border_dir[border]), list);
+
+  clusters[cluster].border_valid[border] = true;
+  clusters[cluster].edges_valid = false;
+  clusters[other].edges_valid = false;
+}
+
+/* Add entrances for the crossings from cluster from to its neighbour
+   to in direction dir. Neighbouring crossings are grouped in runs and
+   an entrance is placed at the middle of each run. */
+void
+RoadPlanner::add_crossings(unsigned int from, unsigned int to,
+                           Direction dir, std::vector<unsigned int> *border) {
+  /* Tile directions that cross the border, and whether the crossings
+     line up along a column (for left and right borders). */
+  Direction dirs[2] = { dir, dir };
+  bool vertical = false;
+  switch (dir) {
+    case DirectionRight: dirs[1] = DirectionDownRight; vertical = true; break;
+    case DirectionDown: dirs[1] = DirectionDownRight; break;
+    case DirectionLeft: dirs[1] = DirectionUpLeft; vertical = true; break;
+    case DirectionUp: dirs[1] = DirectionUpLeft; break;
+    default: break;
+  }
+
+  int col0 = (from % cluster_cols) << ROAD_PLANNER_CLUSTER_SHIFT;
+  int row0 = (from / cluster_cols) << ROAD_PLANNER_CLUSTER_SHIFT;
+
+  /* Crossings ordered along the border: (position along it, tile, dir). */
+  std::vector<std::pair<int, std::pair<MapPos, int> > > crossings;
+  for (int y = 0; y < ROAD_PLANNER_CLUSTER_SIZE; y++) {
+    for (int x = 0; x < ROAD_PLANNER_CLUSTER_SIZE; x++) {
+      MapPos pos = map->pos(col0 + x, row0 + y);
+      for (int i = 0; i < 2; i++) {
+        if (i == 1 && dirs[1] == dirs[0]) break;
+        MapPos other = map->move(pos, dirs[i]);
+        if (get_cluster(other) != to ||
+            !map->is_road_segment_valid(pos, dirs[i]) ||
+            map->get_obj(other) == Map::ObjectFlag) {
+          continue;
+        }
+        crossings.push_back(std::make_pair(vertical ? y : x,
+                                           std::make_pair(pos, dirs[i])));
+      }
+    }
+  }
+  std::stable_sort(crossings.begin(), crossings.end());
+
+  size_t first = 0;
+  for (size_t i = 1; i <= crossings.size(); i++) {
+    if (i < crossings.size() &&
+        crossings[i].first - crossings[i-1].first <= 1 &&
+        i - first < ROAD_PLANNER_MAX_ENTRANCE) {
+      continue;
+    }
+
+    /* End of run, place entrance at the middle. */
+    MapPos pos = crossings[(first + i - 1) / 2].second.first;
+    Direction d = static_cast<Direction>(crossings[(first + i - 1) / 2]
+                                         .second.second);
+    MapPos other = map->move(pos, d);
+    unsigned int node = add_node(pos);
+    unsigned int target = add_node(other);
+    nodes[node].cross_target = target;
+    nodes[node].cross_cost = walk_cost[abs(
+      static_cast<int>(map->get_height(pos)) -
+      static_cast<int>(map->get_height(other)))];
+    border->push_back(node);
+    border->push_back(target);
+
+    first = i;
+  }
+}
+
+/* Compute the cost of walking between each pair of entrances of the
+   cluster. */
+void
+RoadPlanner::build_edges(unsigned int cluster) {
+  std::vector<unsigned int> list;
+  get_cluster_nodes(cluster, &list);
+
+  for (size_t i = 0; i < list.size(); i++) {
+    Node *node = &nodes[list[i]];
+    node->edges.clear();
+    search_cluster(node->pos, bad_map_pos, false);
+
+    for (size_t j = 0; j < list.size(); j++) {
+      if (i == j) continue;
+      unsigned int dist = get_local_dist(nodes[list[j]].pos);
+      if (dist == ROAD_PLANNER_NONE) continue;
+      Edge edge = { list[j], dist };
+      node->edges.push_back(edge);
+    }
+  }
+
+  clusters[cluster].edges_valid = true;
+}
+
+void
+RoadPlanner::get_cluster_nodes(unsigned int cluster,
+                               std::vector<unsigned int> *result) {
+  for (int k = 0; k < 3; k++) {
+    Direction dir = reverse_direction(border_dir[k]);
+    const std::vector<unsigned int> *lists[] = {
+      &clusters[cluster].border_nodes[k],
+      &clusters[get_neighbour(cluster, dir)].border_nodes[k]
+    };
+    for (int l = 0; l < 2; l++) {
+      for (size_t i = 0; i < lists[l]->size(); i++) {
+        unsigned int node = (*lists[l])[i];
+        if (nodes[node].cluster == cluster) result->push_back(node);
+      }
+    }
+  }
+}
+
+/* Dijkstra search within the cluster of from, leaving the cost of
+   walking from from to each position of the cluster in local_dist.
+   If reverse is set the costs of walking from each position to from
+   are computed instead. Flags are only entered if they are start. */
+void
+RoadPlanner::search_cluster(MapPos from, MapPos start, bool reverse) {
+  std::fill(local_dist.begin(), local_dist.end(), ROAD_PLANNER_NONE);
+
+  unsigned int cluster = get_cluster(from);
+  int col0 = (cluster % cluster_cols) << ROAD_PLANNER_CLUSTER_SHIFT;
+  int row0 = (cluster / cluster_cols) << ROAD_PLANNER_CLUSTER_SHIFT;
+
+  typedef std::pair<unsigned int, MapPos> Entry;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > open;
+
+  local_dist[(map->pos_row(from) - row0) << ROAD_PLANNER_CLUSTER_SHIFT |
+             (map->pos_col(from) - col0)] = 0;
+  open.push(Entry(0, from));
+
+  while (!open.empty()) {
+    Entry entry = open.top();
+    open.pop();
+    if (entry.first != get_local_dist(entry.second)) continue;
+
+    for (int d = DirectionRight; d <= DirectionUp; d++) {
+      MapPos new_pos = map->move(entry.second, (Direction)d);
+      if (get_cluster(new_pos) != cluster) continue;
+
+      if (reverse) {
+        /* The road goes from new_pos to the current position. */
+        if (!map->is_road_segment_valid(new_pos,
+                                    reverse_direction((Direction)d)) ||
+            map->get_obj(new_pos) == Map::ObjectFlag) {
+          continue;
+        }
+      } else {
+        if (!map->is_road_segment_valid(entry.second, (Direction)d) ||
+            (map->get_obj(new_pos) == Map::ObjectFlag && new_pos != start)) {
+          continue;
+        }
+      }
+
+      unsigned int dist = entry.first +
+                          actual_cost(map, entry.second, (Direction)d);
+      unsigned int *local = &local_dist[
+        (map->pos_row(new_pos) - row0) << ROAD_PLANNER_CLUSTER_SHIFT |
+        (map->pos_col(new_pos) - col0)];
+      if (dist < *local) {
+        *local = dist;
+        open.push(Entry(dist, new_pos));
+      }
+    }
+  }
+}
+
+/* Cost found by the last search_cluster() for a position of the same
+   cluster. */
+unsigned int
+RoadPlanner::get_local_dist(MapPos pos) const {
+  unsigned int mask = ROAD_PLANNER_CLUSTER_SIZE - 1;
+  return local_dist[(map->pos_row(pos) & mask) << ROAD_PLANNER_CLUSTER_SHIFT |
+                    (map->pos_col(pos) & mask)];
+}
+
+unsigned int
+RoadPlanner::add_node(MapPos pos) {
+  unsigned int node;
+  if (!free_nodes.empty()) {
+    node = free_nodes.back();
+    free_nodes.pop_back();
+  } else {
+    node = static_cast<unsigned int>(nodes.size());
+    nodes.push_back(Node());
+  }
+
+  nodes[node].pos = pos;
+  nodes[node].cluster = get_cluster(pos);
+  nodes[node].cross_target = ROAD_PLANNER_NONE;
+  nodes[node].cross_cost = 0;
+  nodes[node].edges.clear();
+
+  return node;
+}
+
+void
+RoadPlanner::free_node(unsigned int node) {
+  nodes[node].cross_target = ROAD_PLANNER_NONE;
+  nodes[node].edges.clear();
+  free_nodes.push_back(node);
+}
+
+/* A* search on the abstract graph, from end to start like
+   pathfinder_map(). On success the clusters that the path passes
+   through are set in corridor. */
+bool
+RoadPlanner::find_abstract_path(MapPos start, MapPos end,
+                                std::vector<bool> *corridor) {
+  unsigned int start_cluster = get_cluster(start);
+  unsigned int end_cluster = get_cluster(end);
+  ensure_cluster(start_cluster);
+  ensure_cluster(end_cluster);
+
+  /* Cost of reaching start from the entrances of its cluster. */
+  std::vector<unsigned int> start_nodes;
+  std::vector<unsigned int> goal_cost;
+  get_cluster_nodes(start_cluster, &start_nodes);
+  search_cluster(start, start, true);
+  for (size_t i = 0; i < start_nodes.size(); i++) {
+    goal_cost.push_back(get_local_dist(nodes[start_nodes[i]].pos));
+  }
+
+  generation += 1;
+  if (generation == 0) {
+    std::fill(node_generation.begin(), node_generation.end(), 0);
+    generation = 1;
+  }
+
+  typedef std::pair<unsigned int, unsigned int> Entry;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry> > open;
+
+  /* Enter the abstract graph at the entrances of the end cluster. */
+  std::vector<unsigned int> end_nodes;
+  get_cluster_nodes(end_cluster, &end_nodes);
+  search_cluster(end, start, false);
+  for (size_t i = 0; i < end_nodes.size(); i++) {
+    unsigned int node = end_nodes[i];
+    unsigned int dist = get_local_dist(nodes[node].pos);
+    if (dist == ROAD_PLANNER_NONE) continue;
+
+    if (node >= node_generation.size()) {
+      node_generation.resize(nodes.size(), 0);
+      node_g_score.resize(nodes.size());
+      node_parent.resize(nodes.size());
+    }
+    if (node_generation[node] == generation &&
+        node_g_score[node] <= dist) {
+      continue;
+    }
+    node_generation[node] = generation;
+    node_g_score[node] = dist;
+    node_parent[node] = ROAD_PLANNER_NONE;
+    open.push(Entry(dist + heuristic_cost(map, start, nodes[node].pos),
+                    node));
+  }
+
+  unsigned int best_cost = ROAD_PLANNER_NONE;
+  unsigned int best_node = ROAD_PLANNER_NONE;
+
+  while (!open.empty()) {
+    Entry entry = open.top();
+    open.pop();
+    if (entry.first >= best_cost) break;
+
+    unsigned int node = entry.second;
+    unsigned int g_score = node_g_score[node];
+    if (entry.first != g_score + heuristic_cost(map, start, nodes[node].pos)) {
+      continue;
+    }
+
+    if (nodes[node].cluster == start_cluster) {
+      for (size_t i = 0; i < start_nodes.size(); i++) {
+        if (start_nodes[i] != node || goal_cost[i] == ROAD_PLANNER_NONE) {
+          continue;
+        }
+        if (g_score + goal_cost[i] < best_cost) {
+          best_cost = g_score + goal_cost[i];
+          best_node = node;
+        }
+      }
+    }
+
+    ensure_cluster(nodes[node].cluster);
+    if (nodes.size() > node_generation.size()) {
+      node_generation.resize(nodes.size(), 0);
+      node_g_score.resize(nodes.size());
+      node_parent.resize(nodes.size());
+    }
+
+    std::vector<Edge> edges = nodes[node].edges;
+    if (nodes[node].cross_target != ROAD_PLANNER_NONE) {
+      Edge edge = { nodes[node].cross_target, nodes[node].cross_cost };
+      edges.push_back(edge);
+    }
+
+    for (size_t i = 0; i < edges.size(); i++) {
+      unsigned int target = edges[i].target;
+      unsigned int new_g_score = g_score + edges[i].cost;
+      if (node_generation[target] == generation &&
+          node_g_score[target] <= new_g_score) {
+        continue;
+      }
+
+      node_generation[target] = generation;
+      node_g_score[target] = new_g_score;
+      node_parent[target] = node;
+      open.push(Entry(new_g_score +
+                      heuristic_cost(map, start, nodes[target].pos), target));
+    }
+  }
+
+  if (best_node == ROAD_PLANNER_NONE) return false;
+
+  corridor->assign(clusters.size(), false);
+  (*corridor)[start_cluster] = true;
+  (*corridor)[end_cluster] = true;
+  for (unsigned int node = best_node; node != ROAD_PLANNER_NONE;
+       node = node_parent[node]) {
+    (*corridor)[nodes[node].cluster] = true;
+  }
+
+  return true;
+}
@@ -22,8 +22,107 @@
 #ifndef SRC_PATHFINDER_H_
 #define SRC_PATHFINDER_H_
 
+#include <vector>
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+
 #include "src/map.h"
 
+/* Size of the clusters of the road planner (log2 of the side). */
+#define ROAD_PLANNER_CLUSTER_SHIFT  4
+
 Road pathfinder_map(Map *map, MapPos start, MapPos end);
 
+/* Plans long roads with a hierarchical search (HPA*). The map is
+   divided into square clusters. Where a road can cross the border
+   between two clusters an entrance is placed, and the costs of walking
+   between the entrances of each cluster are precomputed. Long roads
+   are first planned on this abstract graph, then pathfinder_map() is
+   run restricted to the clusters along the abstract path.
+
+   The abstract graph is built lazily, one cluster at a time, and the
+   clusters around a position are rebuilt after the map reports a
+   change there. Short roads and searches that fail on the abstract
+   graph fall back to a plain pathfinder_map(). */
+class RoadPlanner : public Map::Handler {
+ protected:
+  typedef struct Edge {
+    unsigned int target;
+    unsigned int cost;
+  } Edge;
+
+  /* Entrance of a cluster. Entrances come in pairs at both ends of a
+     border crossing; the one the road crosses from has the cross edge. */
+  typedef struct Node {
+    MapPos pos;
+    unsigned int cluster;
+    unsigned int cross_target;
+    unsigned int cross_cost;
+    std::vector<Edge> edges;
+  } Node;
+
+  /* A cluster owns the borders to its right, down right and down
+     neighbours. */
+  typedef struct Cluster {
+    bool border_valid[3];
+    std::vector<unsigned int> border_nodes[3];
+    bool edges_valid;
+  } Cluster;
+
+  Map *map;
+  unsigned int cluster_cols;
+  unsigned int cluster_rows;
+  std::vector<Cluster> clusters;
+  std::vector<Node> nodes;
+  std::vector<unsigned int> free_nodes;
+
+  /* Abstract search state, indexed by node. */
+  std::vector<uint32_t> node_generation;
+  std::vector<unsigned int> node_g_score;
+  std::vector<unsigned int> node_parent;
+  uint32_t generation;
+
+  /* Cluster local search state, indexed by position in the cluster. */
+  std::vector<unsigned int> local_dist;
+
+ public:
+  explicit RoadPlanner(Map *map);
+  virtual ~RoadPlanner();
+
+  Road find_road(MapPos start, MapPos end);
+
+  unsigned int get_node_count() const {
+    return static_cast<unsigned int>(nodes.size() - free_nodes.size()); }
+
+  virtual void on_height_changed(MapPos pos);
+  virtual void on_object_changed(MapPos pos);
+
+ protected:
+  unsigned int get_cluster(MapPos pos) const;
+  unsigned int get_neighbour(unsigned int cluster, Direction dir) const;
+  void invalidate(MapPos pos);
+
+  void ensure_cluster(unsigned int cluster);
+  void build_border(unsigned int cluster, int border);
+  void add_crossings(unsigned int from, unsigned int to, Direction dir,
+                     std::vector<unsigned int> *border);
+  void build_edges(unsigned int cluster);
+  void get_cluster_nodes(unsigned int cluster,
+                         std::vector<unsigned int> *result);
+  void search_cluster(MapPos from, MapPos start, bool reverse);
+  unsigned int get_local_dist(MapPos pos) const;
+
+  unsigned int add_node(MapPos pos);
+  void free_node(unsigned int node);
+
+  bool find_abstract_path(MapPos start, MapPos end,
+                          std::vector<bool> *corridor);
+};
+
 #endif  // SRC_PATHFINDER_H_
@@ -22,6 +22,8 @@
 #include "src/player.h"
 
 #include <algorithm>
+#include <utility>
+#include <vector>
 
 #include "src/game.h"
 #include "src/log.h"
@@ -29,6 +31,9 @@
 #include "src/savegame.h"
 #include "src/building.h"
 
+/* Number of shells around a position searched for knights to attack it. */
+#define ATTACK_SHELLS  32
+
 Player::Player(Game *game, unsigned int index)
   : GameObject(game, index) {
 }
@@ -330,9 +335,9 @@ int
 Player::promote_serfs_to_knights(int number) {
   int promoted = 0;
 
-  Game::ListSerfs serfs = game->get_player_serfs(this);
+  Game::ViewSerfs serfs = game->get_player_serfs(this);
 
-  for (Game::ListSerfs::iterator i = serfs.begin(); i != serfs.end(); ++i) {
+  for (Game::ViewSerfs::iterator i = serfs.begin(); i != serfs.end(); ++i) {
     Serf *serf = *i;
     if (serf->get_state() == Serf::StateIdleInStock &&
         serf->get_type() == Serf::TypeGeneric) {
@@ -396,6 +401,50 @@ Player::available_knights_at_pos(MapPos pos, int index_, int dist) {
   return index_ + 1;
 }
 
+/* Return the order in which the shells around a position reach the
+   position at column and row offset (col, row), or -1 if it is not in
+   any of the shells. The shell number is stored in shell. */
+static int
+get_attack_shell_order(int col, int row, int *shell) {
+  static int order[(2*ATTACK_SHELLS+1)*(2*ATTACK_SHELLS+1)];
+  static int shells[(2*ATTACK_SHELLS+1)*(2*ATTACK_SHELLS+1)];
+  static bool initialized = false;
+
+  const int size = 2*ATTACK_SHELLS+1;
+  if (!initialized) {
+    /* Walk the shells the same way as knights_available_for_attack(). */
+    const int moves[][2] = {
+      { 0, 1 }, { -1, 0 }, { -1, -1 }, { 0, -1 }, { 1, 0 }, { 1, 1 }
+    };
+
+    for (int i = 0; i < size*size; i++) order[i] = -1;
+
+    int c = 0, r = 0, n = 0;
+    for (int i = 0; i < ATTACK_SHELLS; i++) {
+      c += 1;
+      for (int m = 0; m < 6; m++) {
+        for (int j = 0; j < i+1; j++) {
+          int k = (r + ATTACK_SHELLS)*size + (c + ATTACK_SHELLS);
+          order[k] = n++;
+          shells[k] = i;
+          c += moves[m][0];
+          r += moves[m][1];
+        }
+      }
+    }
+    initialized = true;
+  }
+
+  if (col < -ATTACK_SHELLS || col > ATTACK_SHELLS ||
+      row < -ATTACK_SHELLS || row > ATTACK_SHELLS) {
+    return -1;
+  }
+
+  int k = (row + ATTACK_SHELLS)*size + (col + ATTACK_SHELLS);
+  *shell = shells[k];
+  return order[k];
+}
+
 int
 Player::knights_available_for_attack(MapPos pos) {
   /* Reset counters. */
@@ -403,32 +452,63 @@ Player::knights_available_for_attack(MapPos pos) {
 
   int index = 0;
 
-  /* Iterate each shell around the position.*/
-  for (int i = 0; i < 32; i++) {
-    pos = game->get_map()->move_right(pos);
-    for (int j = 0; j < i+1; j++) {
-      index = available_knights_at_pos(pos, index, i >> 3);
-      pos = game->get_map()->move_down(pos);
-    }
-    for (int j = 0; j < i+1; j++) {
-      index = available_knights_at_pos(pos, index, i >> 3);
-      pos = game->get_map()->move_left(pos);
-    }
-    for (int j = 0; j < i+1; j++) {
-      index = available_knights_at_pos(pos, index, i >> 3);
-      pos = game->get_map()->move_up_left(pos);
-    }
-    for (int j = 0; j < i+1; j++) {
-      index = available_knights_at_pos(pos, index, i >> 3);
-      pos = game->get_map()->move_up(pos);
+  Map *map = game->get_map();
+  if (map->get_cols() > 2*ATTACK_SHELLS && map->get_rows() > 2*ATTACK_SHELLS) {
+    /* Only positions with a building can add to the count, so visit the
+       buildings around the position in the order the shells reach them. */
+    std::vector<std::pair<int, MapPos> > found;
+    Game::ListBuildings buildings = game->get_buildings_around(pos,
+                                                               ATTACK_SHELLS);
+    for (Game::ListBuildings::iterator i = buildings.begin();
+         i != buildings.end(); ++i) {
+      MapPos bld_pos = (*i)->get_position();
+      int col = (map->pos_col(bld_pos) - map->pos_col(pos)) &
+                map->get_col_mask();
+      int row = (map->pos_row(bld_pos) - map->pos_row(pos)) &
+                map->get_row_mask();
+      if (col > ATTACK_SHELLS) col -= map->get_cols();
+      if (row > ATTACK_SHELLS) row -= map->get_rows();
+
+      int shell;
+      int order = get_attack_shell_order(col, row, &shell);
+      if (order >= 0) {
+        found.push_back(std::make_pair(order*ATTACK_SHELLS + shell, bld_pos));
+      }
     }
-    for (int j = 0; j < i+1; j++) {
-      index = available_knights_at_pos(pos, index, i >> 3);
-      pos = game->get_map()->move_right(pos);
+    std::sort(found.begin(), found.end());
+
+    for (size_t i = 0; i < found.size(); i++) {
+      int shell = found[i].first % ATTACK_SHELLS;
+      index = available_knights_at_pos(found[i].second, index, shell >> 3);
     }
-    for (int j = 0; j < i+1; j++) {
-      index = available_knights_at_pos(pos, index, i >> 3);
-      pos = game->get_map()->move_down_right(pos);
+  } else {
+    /* On small maps the shells reach some positions more than once. */
+    for (int i = 0; i < ATTACK_SHELLS; i++) {
+      pos = map->move_right(pos);
+      for (int j = 0; j < i+1; j++) {
+        index = available_knights_at_pos(pos, index, i >> 3);
+        pos = map->move_down(pos);
+      }
+      for (int j = 0; j < i+1; j++) {
+        index = available_knights_at_pos(pos, index, i >> 3);
+        pos = map->move_left(pos);
+      }
+      for (int j = 0; j < i+1; j++) {
+        index = available_knights_at_pos(pos, index, i >> 3);
+        pos = map->move_up_left(pos);
+      }
+      for (int j = 0; j < i+1; j++) {
+        index = available_knights_at_pos(pos, index, i >> 3);
+        pos = map->move_up(pos);
+      }
+      for (int j = 0; j < i+1; j++) {
+        index = available_knights_at_pos(pos, index, i >> 3);
+        pos = map->move_right(pos);
+      }
+      for (int j = 0; j < i+1; j++) {
+        index = available_knights_at_pos(pos, index, i >> 3);
+        pos = map->move_down_right(pos);
+      }
     }
   }
 
@@ -644,13 +724,13 @@ int
 Player::spawn_serf(Serf **serf, Inventory **inventory, bool want_knight) {
   if (!can_spawn()) return -1;
 
-  Game::ListInventories inventories = game->get_player_inventories(this);
+  Game::ViewInventories inventories = game->get_player_inventories(this);
   if (inventories.size() < 1) {
     return -1;
   }
 
   Inventory *inv = NULL;
-  for (Game::ListInventories::iterator i = inventories.begin();
+  for (Game::ViewInventories::iterator i = inventories.begin();
        i != inventories.end(); ++i) {
     Inventory *loop_inv = *i;
     if (loop_inv->get_serf_mode() == Inventory::ModeIn) {
@@ -877,16 +957,16 @@ Player::update_knight_morale() {
   unsigned int military_gold = 0;
 
   /* Sum gold collected in inventories */
-  Game::ListInventories inventories = game->get_player_inventories(this);
-  for (Game::ListInventories::iterator i = inventories.begin();
+  Game::ViewInventories inventories = game->get_player_inventories(this);
+  for (Game::ViewInventories::iterator i = inventories.begin();
        i != inventories.end(); ++i) {
     Inventory *inventory = *i;
     inventory_gold += inventory->get_count_of(Resource::TypeGoldBar);
   }
 
   /* Sum gold deposited in military buildings */
-  Game::ListBuildings buildings = game->get_player_buildings(this);
-  for (Game::ListBuildings::iterator i = buildings.begin();
+  Game::ViewBuildings buildings = game->get_player_buildings(this);
+  for (Game::ViewBuildings::iterator i = buildings.begin();
        i != buildings.end(); ++i) {
     Building *building = *i;
     military_gold += building->military_gold_count();
@@ -960,10 +1040,10 @@ resource_map_t
 Player::get_stats_resources() {
   resource_map_t resources;
 
-  Game::ListInventories invs = game->get_player_inventories(this);
+  Game::ViewInventories invs = game->get_player_inventories(this);
 
   /* Sum up resources of all inventories. */
-  for (Game::ListInventories::iterator i = invs.begin(); i != invs.end(); ++i) {
+  for (Game::ViewInventories::iterator i = invs.begin(); i != invs.end(); ++i) {
     Inventory *inventory = *i;
     for (int j = 0; j < 26; j++) {
       resources[(Resource::Type)j] +=
@@ -978,10 +1058,10 @@ Serf::SerfMap
 Player::get_stats_serfs_idle() {
   Serf::SerfMap res;
 
-  Game::ListSerfs serfs = game->get_player_serfs(this);
+  Game::ViewSerfs serfs = game->get_player_serfs(this);
 
   /* Sum up all existing serfs. */
-  for (Game::ListSerfs::iterator i = serfs.begin(); i != serfs.end(); ++i) {
+  for (Game::ViewSerfs::iterator i = serfs.begin(); i != serfs.end(); ++i) {
     Serf *serf = *i;
     if (serf->get_state() == Serf::StateIdleInStock) {
       res[serf->get_type()] += 1;
@@ -995,10 +1075,10 @@ Serf::SerfMap
 Player::get_stats_serfs_potential() {
   Serf::SerfMap res;
 
-  Game::ListInventories invs = game->get_player_inventories(this);
+  Game::ViewInventories invs = game->get_player_inventories(this);
 
   /* Sum up potential serfs of all inventories. */
-  for (Game::ListInventories::iterator i = invs.begin(); i != invs.end(); ++i) {
+  for (Game::ViewInventories::iterator i = invs.begin(); i != invs.end(); ++i) {
     Inventory *inventory = *i;
     if (inventory->free_serf_count() > 0) {
       for (int i = 0; i < 27; i++) {
@@ -1149,9 +1149,9 @@ PopupBox::draw_gauge_full(int x, int y, unsigned int value,
 static void
 calculate_gauge_values(Player *player,
                        unsigned int values[24][BUILDING_MAX_STOCK][2]) {
-  Game::ListBuildings buildings =
+  Game::ViewBuildings buildings =
                                player->get_game()->get_player_buildings(player);
-  for (Game::ListBuildings::iterator i = buildings.begin();
+  for (Game::ViewBuildings::iterator i = buildings.begin();
        i != buildings.end(); ++i) {
     Building *building = *i;
     if (building->is_burning() || !building->has_serf()) {
@@ -2228,10 +2228,10 @@ PopupBox::draw_castle_serf_box() {
   }
 
   Inventory *inventory = building->get_inventory();
-  Game::ListSerfs inv_srfs =
+  Game::ViewSerfs inv_srfs =
                        interface->get_game()->get_serfs_in_inventory(inventory);
 
-  for (Game::ListSerfs::iterator i = inv_srfs.begin();
+  for (Game::ViewSerfs::iterator i = inv_srfs.begin();
        i != inv_srfs.end(); ++i) {
     Serf *serf = *i;
     serfs[serf->get_type()] += 1;
@@ -2370,9 +2370,9 @@ PopupBox::draw_sett_8_box() {
   }
 
   size_t convertible_to_knights = 0;
-  Game::ListInventories inventories =
+  Game::ViewInventories inventories =
                           interface->get_game()->get_player_inventories(player);
-  for (Game::ListInventories::iterator i = inventories.begin();
+  for (Game::ViewInventories::iterator i = inventories.begin();
        i != inventories.end(); ++i) {
     Inventory *inv = *i;
     size_t c = std::min(inv->get_count_of(Resource::TypeSword),
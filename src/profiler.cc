@@ -0,0 +1,258 @@
+/*
+ * profiler.cc - Timing of game update phases
+ *
+ * Copyright (C) 2017  Jon Lund Steffensen <jonlst@gmail.com>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "src/profiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <chrono>  // NOLINT(build/c++11)
+#include <iomanip>
+#include <sstream>
+
+#include "src/log.h"
+
+TickProfiler::Timer::Timer(TickProfiler *profiler) : profiler(profiler) {
+  start = 0;
+  last = 0;
+  if (profiler != NULL) {
+    start = get_time_nsec();
+    last = start;
+  }
+}
+
+void
+TickProfiler::Timer::lap(Phase phase) {
+  if (profiler == NULL) return;
+
+  uint64_t now = get_time_nsec();
+  profiler->record(phase, static_cast<uint32_t>(now - last));
+  last = now;
+}
+
+void
+TickProfiler::Timer::finish() {
+  if (profiler == NULL) return;
+
+  profiler->record(PhaseTotal, static_cast<uint32_t>(last - start));
+  profiler->next_update();
+}
+
+TickProfiler::TickProfiler() {
+  for (int i = 0; i < PhaseMax; i++) {
+    samples[i].resize(TICK_PROFILER_WINDOW, 0);
+  }
+  reset();
+}
+
+void
+TickProfiler::record(Phase phase, uint32_t nsec) {
+  samples[phase][next] = nsec;
+}
+
+void
+TickProfiler::next_update() {
+  next = (next + 1) % TICK_PROFILER_WINDOW;
+  if (count < TICK_PROFILER_WINDOW) count += 1;
+  updates += 1;
+}
+
+void
+TickProfiler::reset() {
+  next = 0;
+  count = 0;
+  updates = 0;
+}
+
+/* Return the given percentile of the phase time in the window. */
+uint32_t
+TickProfiler::get_percentile(Phase phase, unsigned int percent) const {
+  if (count == 0) return 0;
+
+  std::vector<uint32_t> sorted(samples[phase].begin(),
+                               samples[phase].begin() + count);
+  size_t n = std::min(static_cast<size_t>(count - 1),
+                      static_cast<size_t>(count * percent / 100));
+  std::nth_element(sorted.begin(), sorted.begin() + n, sorted.end());
+
+  return sorted[n];
+}
+
+uint32_t
+TickProfiler::get_mean(Phase phase) const {
+  if (count == 0) return 0;
+
+  uint64_t sum = 0;
+  for (unsigned int i = 0; i < count; i++) {
+    sum += samples[phase][i];
+  }
+
+  return static_cast<uint32_t>(sum / count);
+}
+
+/* Write statistics for each phase to the log. Times are in
+   microseconds. */
+void
+TickProfiler::dump() const {
+  Log::Info["profiler"] << "Game update phases, last " << count << " of "
+                        << updates << " updates (usec):";
+
+  std::ostringstream header;
+  header << std::setw(16) << std::left << "phase" << std::right;
+  header << std::setw(10) << "mean" << std::setw(10) << "p50";
+  header << std::setw(10) << "p90" << std::setw(10) << "p99";
+  header << std::setw(10) << "max";
+  Log::Info["profiler"] << header.str();
+
+  for (int i = 0; i < PhaseMax; i++) {
+    Phase phase = static_cast<Phase>(i);
+
+    std::ostringstream line;
+    line << std::setw(16) << std::left << get_phase_name(phase) << std::right;
+    line << std::fixed << std::setprecision(1);
+    line << std::setw(10) << get_mean(phase) / 1000.0;
+    line << std::setw(10) << get_percentile(phase, 50) / 1000.0;
+    line << std::setw(10) << get_percentile(phase, 90) / 1000.0;
+    line << std::setw(10) << get_percentile(phase, 99) / 1000.0;
+    line << std::setw(10) << get_percentile(phase, 100) / 1000.0;
+    Log::Info["profiler"] << line.str();
+  }
+}
+
+const char *
+TickProfiler::get_phase_name(Phase phase) {
+  const char *phase_name[] = {
+    "map",
+    "players",
+    "knight morale",
+    "inventories",
+    "flags",
+    "buildings",
+    "serfs",
+    "game stats",
+    "total"
+  };
+
+  return phase_name[phase];
+}
+
+uint64_t
+TickProfiler::get_time_nsec() {
+  std::chrono::steady_clock::duration now =
+    std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+SerfStateProfiler::SerfStateProfiler() {
+  reset();
+}
+
+void
+SerfStateProfiler::begin_update() {
+  memset(current, 0, sizeof(current));
+  current_nsec = 0;
+}
+
+void
+SerfStateProfiler::record(Serf::State state, uint64_t nsec) {
+  current[state].count += 1;
+  current[state].nsec += nsec;
+  total[state].count += 1;
+  total[state].nsec += nsec;
+  current_nsec += nsec;
+}
+
+void
+SerfStateProfiler::end_update() {
+  if (current_nsec >= worst_nsec) {
+    memcpy(worst, current, sizeof(worst));
+    worst_nsec = current_nsec;
+  }
+  updates += 1;
+}
+
+void
+SerfStateProfiler::reset() {
+  memset(total, 0, sizeof(total));
+  memset(current, 0, sizeof(current));
+  memset(worst, 0, sizeof(worst));
+  current_nsec = 0;
+  worst_nsec = 0;
+  updates = 0;
+}
+
+/* Compare states by time spent, most expensive first. */
+class SerfStateCompare {
+ protected:
+  const SerfStateProfiler::Stats *stats;
+
+ public:
+  explicit SerfStateCompare(const SerfStateProfiler::Stats stats[])
+    : stats(stats) {}
+
+  bool operator()(int a, int b) const {
+    return stats[a].nsec > stats[b].nsec;
+  }
+};
+
+/* Write the top states of the given per state statistics to the log. */
+void
+SerfStateProfiler::dump_update(const Stats stats[], size_t top) const {
+  std::vector<int> order;
+  uint64_t sum = 0;
+  for (int i = 0; i < SERF_STATE_COUNT; i++) {
+    if (stats[i].count == 0) continue;
+    order.push_back(i);
+    sum += stats[i].nsec;
+  }
+  std::sort(order.begin(), order.end(), SerfStateCompare(stats));
+  if (order.size() > top) order.resize(top);
+
+  std::ostringstream header;
+  header << std::setw(28) << std::left << "state" << std::right;
+  header << std::setw(12) << "calls" << std::setw(12) << "usec";
+  header << std::setw(10) << "ns/call" << std::setw(8) << "%";
+  Log::Info["profiler"] << header.str();
+
+  for (size_t i = 0; i < order.size(); i++) {
+    const Stats &s = stats[order[i]];
+    std::ostringstream line;
+    line << std::setw(28) << std::left;
+    line << Serf::get_state_name(static_cast<Serf::State>(order[i]));
+    line << std::right << std::fixed << std::setprecision(1);
+    line << std::setw(12) << s.count;
+    line << std::setw(12) << s.nsec / 1000.0;
+    line << std::setw(10) << s.nsec / s.count;
+    line << std::setw(8) << (sum > 0 ? 100.0 * s.nsec / sum : 0.0);
+    Log::Info["profiler"] << line.str();
+  }
+}
+
+void
+SerfStateProfiler::dump() const {
+  Log::Info["profiler"] << "Serf states, total over " << updates
+                        << " updates:";
+  dump_update(total, SERF_STATE_COUNT);
+  Log::Info["profiler"] << "Serf states, slowest update ("
+                        << worst_nsec / 1000.0 << " usec):";
+  dump_update(worst, 10);
+  Log::Info["profiler"] << "Serf states, last update:";
+  dump_update(current, 10);
+}
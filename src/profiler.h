@@ -0,0 +1,136 @@
+/*
+ * profiler.h - Timing of game update phases
+ *
+ * Copyright (C) 2017  Jon Lund Steffensen <jonlst@gmail.com>
+ *
+ * This file is part of freeserf.
+ *
+ * freeserf is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * freeserf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with freeserf.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SRC_PROFILER_H_
+#define SRC_PROFILER_H_
+
+#include <vector>
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+
+#include "src/serf.h"
+
+/* Number of most recent game updates used for the statistics. */
+#define TICK_PROFILER_WINDOW  1024
+
+#define SERF_STATE_COUNT  (Serf::StateKnightAttackingDefeatFree + 1)
+
+/* Records the time spent in each phase of Game::update() over a
+   window of the most recent updates. The statistics are written to
+   the log by dump(). */
+class TickProfiler {
+ public:
+  typedef enum Phase {
+    PhaseMap = 0,
+    PhasePlayers,
+    PhaseKnightMorale,
+    PhaseInventories,
+    PhaseFlags,
+    PhaseBuildings,
+    PhaseSerfs,
+    PhaseGameStats,
+    PhaseTotal,
+
+    PhaseMax
+  } Phase;
+
+  /* Measures consecutive phases of one update. Each call to lap()
+     records the time since the previous lap (or construction) for
+     the given phase. Does nothing when profiler is NULL. */
+  class Timer {
+   protected:
+    TickProfiler *profiler;
+    uint64_t start;
+    uint64_t last;
+
+   public:
+    explicit Timer(TickProfiler *profiler);
+
+    void lap(Phase phase);
+    void finish();
+  };
+
+ protected:
+  std::vector<uint32_t> samples[PhaseMax];
+  unsigned int next;
+  unsigned int count;
+  uint64_t updates;
+
+ public:
+  TickProfiler();
+
+  void record(Phase phase, uint32_t nsec);
+  void next_update();
+  void reset();
+
+  uint64_t get_updates() const { return updates; }
+  uint32_t get_percentile(Phase phase, unsigned int percent) const;
+  uint32_t get_mean(Phase phase) const;
+
+  void dump() const;
+
+  static const char *get_phase_name(Phase phase);
+  static uint64_t get_time_nsec();
+};
+
+/* Records the number of calls to Serf::update() and the time spent
+   in it for each serf state. The state is taken before the update,
+   so the time is attributed to the state handler that ran. Apart
+   from the totals the breakdown of the most recent update and of
+   the slowest update seen are kept. */
+class SerfStateProfiler {
+ public:
+  typedef struct Stats {
+    uint64_t count;
+    uint64_t nsec;
+  } Stats;
+
+ protected:
+  Stats total[SERF_STATE_COUNT];
+  Stats current[SERF_STATE_COUNT];
+  Stats worst[SERF_STATE_COUNT];
+  uint64_t current_nsec;
+  uint64_t worst_nsec;
+  uint64_t updates;
+
+ public:
+  SerfStateProfiler();
+
+  void begin_update();
+  void record(Serf::State state, uint64_t nsec);
+  void end_update();
+  void reset();
+
+  const Stats &get_total(Serf::State state) const { return total[state]; }
+  const Stats &get_last_update(Serf::State state) const {
+    return current[state]; }
+
+  void dump() const;
+  void dump_update(const Stats stats[], size_t top) const;
+};
+
+#endif  // SRC_PROFILER_H_
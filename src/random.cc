@@ -53,6 +53,15 @@ Random::Random(const Random &random_state) {
   state[2] = random_state.state[2];
 }
 
+Random &
+Random::operator=(const Random &random_state) {
+  state[0] = random_state.state[0];
+  state[1] = random_state.state[1];
+  state[2] = random_state.state[2];
+
+  return *this;
+}
+
 Random::Random(const std::string &string) {
   uint64_t tmp = 0;
 
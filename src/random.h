@@ -43,6 +43,8 @@ class Random {
   explicit Random(const std::string &string);
   Random(uint16_t base_0, uint16_t base_1, uint16_t base_2);
 
+  Random &operator=(const Random &random_state);
+
   uint16_t random();
 
   operator std::string() const;
@@ -22,6 +22,7 @@
 #include "src/serf.h"
 
 #include <cassert>
+#include <climits>
 #include <algorithm>
 #include <map>
 
@@ -38,6 +39,7 @@
                        << "state " << Serf::get_state_name(state) \
                        << " -> " << Serf::get_state_name((new_state)) \
                        << " (" << __FUNCTION__ << ":" << __LINE__ << ")"; \
+  if (state == StateIdleInStock) game->serf_left_stock(this); \
   state = new_state;
 
 #define set_other_state(other_serf, new_state)  \
@@ -47,6 +49,9 @@
                        << Serf::get_state_name(other_serf->state) \
                        << " -> " << Serf::get_state_name((new_state)) \
                        << "(" << __FUNCTION__ << ":" << __LINE__ << ")"; \
+  if (other_serf->state == StateIdleInStock) { \
+    game->serf_left_stock(other_serf); \
+  } \
   other_serf->state = new_state;
 
 
@@ -298,6 +303,22 @@ Serf::Serf(Game *game, unsigned int index) : GameObject(game, index) {
   pos = -1;
 }
 
+void
+Serf::set_player(unsigned int player_num) {
+  unsigned int old_owner = owner;
+  owner = player_num;
+  game->serf_owner_changed(this, old_owner);
+}
+
+/* Move serf to new position, keeping the game's index of serfs
+   by position up to date. */
+void
+Serf::set_pos(MapPos new_pos) {
+  MapPos old_pos = pos;
+  pos = new_pos;
+  game->serf_pos_changed(this, old_pos);
+}
+
 /* Change type of serf and update all global tables
    tracking serf types. */
 void
@@ -309,6 +330,10 @@ Serf::set_type(Serf::Type new_type) {
   if (new_type == TypeTransporterInventory) new_type = TypeTransporter;
   if (old_type == TypeTransporterInventory) old_type = TypeTransporter;
 
+  if (state == StateIdleInStock) {
+    game->wake_stock_serfs(s.idle_in_stock.inv_index);
+  }
+
   Player *player = game->get_player(get_player());
   player->decrease_serf_count(old_type);
 
@@ -345,10 +370,12 @@ Serf::init_generic(Inventory *inventory) {
   set_type(TypeGeneric);
   set_player(inventory->get_owner());
   Building *building = game->get_building(inventory->get_building_index());
-  pos = building->get_position();
+  set_pos(building->get_position());
   tick = game->get_tick();
+  if (state == StateIdleInStock) game->serf_left_stock(this);
   state = StateIdleInStock;
   s.idle_in_stock.inv_index = inventory->get_index();
+  game->serf_entered_stock(this);
 }
 
 void
@@ -567,6 +594,7 @@ Serf::building_deleted(MapPos building_pos, bool escape) {
       (state == StateIdleInStock || state == StateReadyToLeaveInventory)) {
     if (escape) {
       /* Serf is escaping. */
+      if (state == StateIdleInStock) game->serf_left_stock(this);
       state = StateEscapeBuilding;
     } else {
       /* Kill this serf. */
@@ -769,6 +797,7 @@ void
 Serf::stay_idle_in_stock(unsigned int inventory) {
   set_state(StateIdleInStock);
   s.idle_in_stock.inv_index = inventory;
+  game->serf_entered_stock(this);
 }
 
 void
@@ -919,6 +948,41 @@ Serf::train_knight(int p) {
   return -1;
 }
 
+/* Tick at which updating this idle serf has an effect again, assuming
+   that the inventory keeps it idle. Only knights in training count down,
+   others are never woken by time. Returns false when the serf can not
+   be parked. */
+bool
+Serf::get_idle_in_stock_wake_tick(unsigned int *wake_tick) {
+  if (state != StateIdleInStock) return false;
+
+  if (get_type() < TypeKnight0 || get_type() > TypeKnight3) {
+    *wake_tick = UINT_MAX;
+    return true;
+  }
+
+  /* The serf tick only has 16 bits, so train_knight() only skips
+     ticks correctly within the first 0x10000 game ticks. */
+  int wake = tick + counter + 1;
+  if (wake <= static_cast<int>(game->get_tick()) || wake > 0x10000) {
+    return false;
+  }
+
+  *wake_tick = wake;
+  return true;
+}
+
+/* Apply the training of a parked knight up to the given serf update
+   tick, as train_knight() would have done. */
+void
+Serf::catch_up_idle_in_stock(unsigned int update_tick) {
+  if (get_type() < TypeKnight0 || get_type() > TypeKnight3) return;
+
+  int delta = update_tick - tick;
+  tick = update_tick;
+  counter -= delta;
+}
+
 void
 Serf::handle_serf_idle_in_stock_state() {
   Inventory *inventory = game->get_inventory(s.idle_in_stock.inv_index);
@@ -983,7 +1047,7 @@ Serf::change_direction(Direction dir, int alt_end) {
         (other_dir == reverse_direction(dir) || other_dir == DirectionNone) &&
         other_serf->switch_waiting(reverse_direction(dir))) {
       /* Do the switch */
-      other_serf->pos = pos;
+      other_serf->set_pos(pos);
       game->get_map()->set_serf_index(other_serf->pos, other_serf->get_index());
       other_serf->animation =
            get_walking_animation(game->get_map()->get_height(other_serf->pos) -
@@ -1005,7 +1069,7 @@ Serf::change_direction(Direction dir, int alt_end) {
   }
 
   if (!alt_end) s.walking.wait_counter = 0;
-  pos = new_pos;
+  set_pos(new_pos);
   game->get_map()->set_serf_index(pos, get_index());
   counter += counter_from_animation[animation];
   if (alt_end && counter < 0) {
@@ -1057,19 +1121,6 @@ Serf::transporter_move_to_flag(Flag *flag) {
   change_direction(dir, 1);
 }
 
-bool
-Serf::handle_serf_walking_state_search_cb(Flag *flag, void *data) {
-  Serf *serf = static_cast<Serf*>(data);
-  Flag *dest = flag->get_game()->get_flag(serf->s.walking.dest);
-  if (flag == dest) {
-    Log::Verbose["serf"] << " dest found: " << dest->get_search_dir();
-    serf->change_direction(dest->get_search_dir(), 0);
-    return 1;
-  }
-
-  return 0;
-}
-
 void
 Serf::start_walking(Direction dir, int slope, int change_pos) {
   MapPos new_pos = game->get_map()->move(pos, dir);
@@ -1082,7 +1133,7 @@ Serf::start_walking(Direction dir, int slope, int change_pos) {
     game->get_map()->set_serf_index(new_pos, get_index());
   }
 
-  pos = new_pos;
+  set_pos(new_pos);
 }
 
 static const int road_building_slope[] = {
@@ -1246,18 +1297,31 @@ Serf::handle_serf_walking_state() {
         handle_serf_walking_state_dest_reached();
         return;
       } else {
+        /* Search from the neighbour flags. A flag reached by more
+           than one path is searched from with the last direction. */
         Flag *src = game->get_flag_at_pos(pos);
-        FlagSearch search(game);
+        Flag *sources[6];
+        Direction dirs[6];
+        int count = 0;
         for (int i = 0; i < 6; i++) {
           if (!src->is_water_path((Direction)(5-i))) {
             Flag *other_flag = src->get_other_end_flag((Direction)(5-i));
-            other_flag->set_search_dir((Direction)(5-i));
-            search.add_source(other_flag);
+            int j = 0;
+            while (j < count && sources[j] != other_flag) j++;
+            if (j == count) sources[count++] = other_flag;
+            dirs[j] = (Direction)(5-i);
           }
         }
-        bool r = search.execute(handle_serf_walking_state_search_cb,
-                                true, false, this);
-        if (r) continue;
+
+        Flag *dest = game->get_flag(s.walking.dest);
+        int first = game->get_flag_routes()->find_first_source(dest, false,
+                                                               sources, count,
+                                                               NULL);
+        if (first >= 0) {
+          Log::Verbose["serf"] << " dest found: " << dirs[first];
+          change_direction(dirs[first], 0);
+          continue;
+        }
       }
     } else {
       /* 30A37 */
@@ -1420,6 +1484,7 @@ Serf::enter_inventory() {
   /*serf->s.idle_in_stock.field_B = 0;
     serf->s.idle_in_stock.field_C = 0;*/
   s.idle_in_stock.inv_index = building->get_inventory()->get_index();
+  game->serf_entered_stock(this);
 }
 
 void
@@ -1771,6 +1836,7 @@ Serf::handle_serf_entering_building_state() {
 
       set_state(StateIdleInStock);
       s.idle_in_stock.inv_index = inventory->get_index();
+      game->serf_entered_stock(this);
       break;
     }
     case TypeKnight0:
@@ -1970,7 +2036,7 @@ Serf::handle_serf_digging_state() {
             other_dir == reverse_direction(dir) &&
             other_serf->switch_waiting(other_dir)) {
           /* Do the switch */
-          other_serf->pos = pos;
+          other_serf->set_pos(pos);
           game->get_map()->set_serf_index(other_serf->pos,
                                           other_serf->get_index());
           other_serf->animation =
@@ -2006,7 +2072,7 @@ Serf::handle_serf_digging_state() {
       }
 
       game->get_map()->set_serf_index(new_pos, get_index());
-      pos = new_pos;
+      set_pos(new_pos);
       s.digging.substate = 3;
       counter += counter_from_animation[animation];
     } else if (s.digging.substate == 1) {
@@ -2750,8 +2816,8 @@ Serf::handle_serf_free_walking_switch_with_other() {
     other_serf->counter = counter_from_animation[other_serf->animation];
     counter = counter_from_animation[animation];
 
-    other_serf->pos = pos;
-    pos = new_pos;
+    other_serf->set_pos(pos);
+    set_pos(new_pos);
   } else {
     animation = 82;
     counter = counter_from_animation[animation];
@@ -3048,7 +3114,7 @@ Serf::handle_free_walking_common() {
           (other_dir == reverse_direction(d) || other_dir == DirectionNone) &&
           other_serf->switch_waiting(reverse_direction(d))) {
         /* Do the switch */
-        other_serf->pos = pos;
+        other_serf->set_pos(pos);
         game->get_map()->set_serf_index(other_serf->pos,
                                         other_serf->get_index());
         other_serf->animation =
@@ -3061,7 +3127,7 @@ Serf::handle_free_walking_common() {
                                         game->get_map()->get_height(pos), d, 1);
         counter = counter_from_animation[animation];
 
-        pos = new_pos;
+        set_pos(new_pos);
         game->get_map()->set_serf_index(pos, index);
         return;
       }
@@ -3171,10 +3237,21 @@ Serf::handle_serf_planning_logging_state() {
   tick = game->get_tick();
   counter -= delta;
 
+  /* The spiral can only reach a tree if there is one nearby. */
+  Map *map = game->get_map();
+  bool tree_near = (counter < 0 &&
+                    map->has_objects_near(pos, Map::ObjectClassTree,
+                                          Map::get_spiral_radius(0x80)));
+
   while (counter < 0) {
     int index = (game->random_int() & 0x7f) + 1;
-    MapPos pos_ = game->get_map()->pos_add_spirally(pos, index);
-    int obj = game->get_map()->get_obj(pos_);
+    if (!tree_near) {
+      counter += 400;
+      continue;
+    }
+
+    MapPos pos_ = map->pos_add_spirally(pos, index);
+    int obj = map->get_obj(pos_);
     if (obj >= Map::ObjectTree0 && obj <= Map::ObjectPine7) {
       set_state(StateReadyToLeave);
       s.leaving_building.field_B = Map::get_spiral_pattern()[2*index] - 1;
@@ -3261,10 +3338,22 @@ Serf::handle_serf_planning_stonecutting() {
   tick = game->get_tick();
   counter -= delta;
 
+  /* The spiral can only reach a stone if there is one nearby. The stone
+     is up-left of the position in the spiral. */
+  Map *map = game->get_map();
+  bool stone_near = (counter < 0 &&
+                     map->has_objects_near(pos, Map::ObjectClassStone,
+                                           Map::get_spiral_radius(0x80) + 1));
+
   while (counter < 0) {
     int index = (game->random_int() & 0x7f) + 1;
-    MapPos pos_ = game->get_map()->pos_add_spirally(pos, index);
-    int obj = game->get_map()->get_obj(game->get_map()->move_up_left(pos_));
+    if (!stone_near) {
+      counter += 100;
+      continue;
+    }
+
+    MapPos pos_ = map->pos_add_spirally(pos, index);
+    int obj = map->get_obj(map->move_up_left(pos_));
     if (obj >= Map::ObjectStone0 && obj <= Map::ObjectStone7 &&
         can_pass_map_pos(pos_)) {
       set_state(StateReadyToLeave);
@@ -3390,8 +3479,11 @@ Serf::handle_serf_lost_state() {
   counter -= delta;
 
   while (counter < 0) {
-    /* Try to find a suitable destination. */
-    for (int i = 0; i < 258; i++) {
+    /* Try to find a suitable destination. The spiral can only reach a
+       flag if there is one nearby. */
+    int spiral_count = game->get_map()->has_objects_near(
+      pos, Map::ObjectClassFlag, Map::get_spiral_radius(258)) ? 258 : 0;
+    for (int i = 0; i < spiral_count; i++) {
       int index = (s.lost.field_B == 0) ? 1+i : 258-i;
       MapPos dest = game->get_map()->pos_add_spirally(pos, index);
 
@@ -4719,7 +4811,7 @@ Serf::handle_state_knight_free_walking() {
         Serf *other = game->get_serf(game->get_map()->get_serf_index(pos_));
         if (get_player() != other->get_player()) {
           if (other->state == StateKnightFreeWalking) {
-            pos = game->get_map()->move_left(pos_);
+            set_pos(game->get_map()->move_left(pos_));
             if (can_pass_map_pos(pos_)) {
               int dist_col = s.free_walking.dist1;
               int dist_row = s.free_walking.dist2;
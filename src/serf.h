@@ -363,7 +363,7 @@ class Serf : public GameObject {
   Serf(Game *game, unsigned int index);
 
   unsigned int get_player() { return owner; }
-  void set_player(unsigned int player_num) { owner = player_num; }
+  void set_player(unsigned int player_num);
 
   Type get_type() { return type; }
   void set_type(Type type);
@@ -379,6 +379,8 @@ class Serf : public GameObject {
   MapPos get_pos() { return pos; }
 
   int train_knight(int p);
+  bool get_idle_in_stock_wake_tick(unsigned int *wake_tick);
+  void catch_up_idle_in_stock(unsigned int update_tick);
 
   void set_lost_state();
 
@@ -446,6 +448,7 @@ class Serf : public GameObject {
     operator << (SaveWriterText &writer, Serf &serf);
 
  protected:
+  void set_pos(MapPos new_pos);
   int is_waiting(Direction *dir);
   int switch_waiting(Direction dir);
   int get_walking_animation(int h_diff, Direction dir, int switch_pos);
@@ -460,8 +463,6 @@ class Serf : public GameObject {
   bool can_pass_map_pos(MapPos pos);
   void set_fight_outcome(Serf *attacker, Serf *defender);
 
-  static bool handle_serf_walking_state_search_cb(Flag *flag, void *data);
-
   void handle_serf_idle_in_stock_state();
   void handle_serf_walking_state_dest_reached();
   void handle_serf_walking_state_waiting();
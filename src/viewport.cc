@@ -2125,23 +2125,13 @@ Viewport::draw_map_cursor_possible_build() {
 
       /* Draw possible building */
       int sprite = -1;
-      if (interface->get_game()->can_build_castle(pos,
-                                                  interface->get_player())) {
-        sprite = 50;
-      } else if (interface->get_game()->can_player_build(pos,
-                                                     interface->get_player()) &&
-                 Map::map_space_from_obj[map->get_obj(pos)] ==
-                   Map::SpaceOpen &&
-               (interface->get_game()->can_build_flag(map->move_down_right(pos),
-                                      interface->get_player()) ||
-                 map->has_flag(map->move_down_right(pos)))) {
-        if (interface->get_game()->can_build_mine(pos)) {
-          sprite = 48;
-        } else if (interface->get_game()->can_build_large(pos)) {
-          sprite = 50;
-        } else if (interface->get_game()->can_build_small(pos)) {
-          sprite = 49;
-        }
+      switch (interface->get_game()->get_build_possibility(pos,
+                                                   interface->get_player())) {
+        case Game::BuildPossibilityMine: sprite = 48; break;
+        case Game::BuildPossibilitySmall: sprite = 49; break;
+        case Game::BuildPossibilityLarge: sprite = 50; break;
+        case Game::BuildPossibilityCastle: sprite = 50; break;
+        default: break;
       }
 
       if (sprite >= 0) {
@@ -2331,7 +2321,7 @@ Viewport::handle_dbl_click(int x, int y, Event::Button button) {
   if (interface->is_building_road()) {
     if (clk_pos != interface->get_map_cursor_pos()) {
       MapPos pos = interface->get_building_road().get_end(map);
-      Road road = pathfinder_map(map, pos, clk_pos);
+      Road road = road_planner->find_road(pos, clk_pos);
       if (road.get_length() != 0) {
         int r = interface->extend_road(road);
         if (r < 0) {
@@ -2462,6 +2452,7 @@ Viewport::Viewport(Interface *_interface, Map *_map) {
   interface = _interface;
   map = _map;
   map->add_change_handler(this);
+  road_planner = new RoadPlanner(map);
   layers = LayerAll;
 
   last_tick = 0;
@@ -2472,6 +2463,7 @@ Viewport::Viewport(Interface *_interface, Map *_map) {
 
 Viewport::~Viewport() {
   map->del_change_handler(this);
+  delete road_planner;
   while (landscape_tiles.size()) {
     tiles_map_t::iterator it = landscape_tiles.begin();
     delete it->second;
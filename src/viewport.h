@@ -30,6 +30,7 @@
 
 class Interface;
 class DataSource;
+class RoadPlanner;
 
 class Viewport : public GuiObject, public Map::Handler {
  public:
@@ -60,6 +61,7 @@ class Viewport : public GuiObject, public Map::Handler {
   DataSource *data_source;
 
   Map *map;
+  RoadPlanner *road_planner;
 
  public:
   Viewport(Interface *interface, Map *map);
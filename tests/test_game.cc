@@ -0,0 +1,110 @@
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "src/game.h"
+#include "src/player.h"
+#include "src/random.h"
+
+// Game with access to the uncached build possibility
+class TestGame : public Game {
+ public:
+  TestGame() : Game(0) {}
+
+  using Game::find_build_possibility;
+};
+
+// Check every position of the cached build possibilities
+static int
+check_build_possibilities(TestGame *game, Player *player) {
+  Map *map = game->get_map();
+  int errors = 0;
+
+  for (unsigned int y = 0; y < map->get_rows(); y++) {
+    for (unsigned int x = 0; x < map->get_cols(); x++) {
+      MapPos pos = map->pos(x, y);
+      if (game->get_build_possibility(pos, player) !=
+          game->find_build_possibility(pos, player)) {
+        std::cerr << "Stale build possibility at " << x << "," << y << "\n";
+        errors += 1;
+      }
+    }
+  }
+
+  return errors;
+}
+
+// Check that building and removing roads updates the cached build
+// possibilities
+static int
+test_roads(TestGame *game, Random *random) {
+  Map *map = game->get_map();
+  Player *player = game->get_player(0);
+  std::vector<MapPos> roads;
+  int errors = 0;
+
+  // Without a castle the player could only build a castle anywhere
+  for (MapPos pos = 0; !player->has_castle(); pos++) {
+    game->build_castle(pos, player);
+  }
+
+  for (unsigned int y = 0; y < map->get_rows(); y++) {
+    for (unsigned int x = 0; x < map->get_cols(); x++) {
+      map->set_owner(map->pos(x, y), 0);
+    }
+  }
+
+  errors += check_build_possibilities(game, player);
+
+  for (int i = 0; i < 200; i++) {
+    if (i % 3 == 2 && !roads.empty()) {
+      size_t index = random->random() % roads.size();
+      if (game->demolish_road(roads[index], player)) {
+        errors += check_build_possibilities(game, player);
+      }
+      roads.erase(roads.begin() + index);
+      continue;
+    }
+
+    // Build a straight road between two flags
+    MapPos pos = map->get_rnd_coord(NULL, NULL, random);
+    Direction dir = static_cast<Direction>(random->random() % 6);
+    unsigned int length = 2 + random->random() % 12;
+
+    Road road;
+    road.start(pos);
+    for (unsigned int j = 0; j < length; j++) road.extend(dir);
+    MapPos end = road.get_end(map);
+
+    if (!map->has_flag(pos) && !game->build_flag(pos, player)) continue;
+    if (!map->has_flag(end) && !game->build_flag(end, player)) continue;
+    if (!game->build_road(road, player)) continue;
+
+    errors += check_build_possibilities(game, player);
+    roads.push_back(map->move(pos, dir));
+  }
+
+  return errors;
+}
+
+int
+main() {
+  /* Print number of tests for TAP */
+  std::cout << "1..1" << "\n";
+
+  TestGame game;
+  game.init();
+  game.load_random_map(3, Random("8667715887436237"));
+  game.add_player(12, 64, 40, 40, 40);
+
+  Random random = Random("8667715887436237");
+
+  int errors = test_roads(&game, &random);
+  if (errors > 0) {
+    std::cout << "not ok 1 - Found " << errors <<
+      " build possibility errors!\n";
+  } else {
+    std::cout << "ok 1 - Build possibilities follow roads.\n";
+  }
+}
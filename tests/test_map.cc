@@ -9,11 +9,133 @@
 #include "src/map-generator.h"
 #include "src/random.h"
 
+// Check that objects are never missed by Map::has_objects_near()
+static int
+test_objects_near(Map *map, Random *random) {
+  const Map::Object objects[] = {
+    Map::ObjectNone, Map::ObjectTree0, Map::ObjectStone0, Map::ObjectFlag
+  };
+
+  int errors = 0;
+  for (int i = 0; i < 2000; i++) {
+    // Change objects to check that the index follows them
+    MapPos pos = map->get_rnd_coord(NULL, NULL, random);
+    map->set_object(pos, objects[random->random() % 4], -1);
+
+    pos = map->get_rnd_coord(NULL, NULL, random);
+    int radius = random->random() % 10;
+    for (int cls = 0; cls < Map::ObjectClassMax; cls++) {
+      bool found = false;
+      for (int y = -radius; y <= radius && !found; y++) {
+        for (int x = -radius; x <= radius && !found; x++) {
+          MapPos p = map->pos((map->pos_col(pos) + x) & map->get_col_mask(),
+                              (map->pos_row(pos) + y) & map->get_row_mask());
+          found = (Map::get_object_class(map->get_obj(p)) == cls);
+        }
+      }
+
+      if (found &&
+          !map->has_objects_near(pos, static_cast<Map::ObjectClass>(cls),
+                                 radius)) {
+        std::cerr << "Missed object of class " << cls << " near " <<
+          map->pos_col(pos) << "," << map->pos_row(pos) << "\n";
+        errors += 1;
+      }
+    }
+  }
+
+  return errors;
+}
+
+// Check that the neighbour table agrees with column and row arithmetic
+static int
+test_move(const Map &map) {
+  const int offsets[][2] = {
+    { 1, 0 }, { 1, 1 }, { 0, 1 }, { -1, 0 },
+    { -1, -1 }, { 0, -1 }, { 1, -1 }, { -1, 1 }
+  };
+
+  int errors = 0;
+  for (unsigned int y = 0; y < map.get_rows(); y++) {
+    for (unsigned int x = 0; x < map.get_cols(); x++) {
+      for (int d = DirectionRight; d <= DirectionDownLeft; d++) {
+        MapPos expected = map.pos((x + offsets[d][0]) & map.get_col_mask(),
+                                  (y + offsets[d][1]) & map.get_row_mask());
+        if (map.move(map.pos(x, y), static_cast<Direction>(d)) != expected) {
+          std::cerr << "Invalid move from " << x << "," << y <<
+            " in direction " << d << "\n";
+          errors += 1;
+        }
+      }
+    }
+  }
+
+  return errors;
+}
+
+// Check the whole map scans against a plain loop over the map
+static int
+test_scans(Map *map, Random *random) {
+  unsigned int tile_count = map->get_rows() * map->get_cols();
+
+  // Mark random positions, with runs of neighbouring ones
+  for (int i = 0; i < 300; i++) {
+    MapPos pos = map->get_rnd_coord(NULL, NULL, random);
+    int length = random->random() % 12;
+    for (int j = 0; j < length; j++) {
+      switch (i % 3) {
+        case 0: map->set_owner(pos, random->random() & 3); break;
+        case 1: map->add_path(pos, DirectionRight); break;
+        case 2: map->set_idle_serf(pos); break;
+      }
+      pos = map->move_right(pos);
+    }
+  }
+  map->set_owner(0, 1);
+  map->set_owner(tile_count - 1, 2);
+
+  int errors = 0;
+
+  unsigned int counts[GAME_MAX_PLAYER_COUNT];
+  unsigned int expected_counts[GAME_MAX_PLAYER_COUNT] = { 0 };
+  map->get_owned_tile_counts(counts);
+  for (MapPos pos = 0; pos < tile_count; pos++) {
+    if (map->has_owner(pos)) expected_counts[map->get_owner(pos)] += 1;
+  }
+  for (int i = 0; i < GAME_MAX_PLAYER_COUNT; i++) {
+    if (counts[i] != expected_counts[i]) {
+      std::cerr << "Invalid owned tile count for player " << i << " is " <<
+        counts[i] << " should have been " << expected_counts[i] << "\n";
+      errors += 1;
+    }
+  }
+
+  // Find the next position from every position
+  for (MapPos start = 0; start <= tile_count; start++) {
+    MapPos owned = bad_map_pos;
+    MapPos path = bad_map_pos;
+    MapPos idle_serf = bad_map_pos;
+    for (MapPos pos = tile_count; pos-- > start; ) {
+      if (map->has_owner(pos)) owned = pos;
+      if (map->paths(pos) != 0) path = pos;
+      if (map->get_idle_serf(pos)) idle_serf = pos;
+    }
+
+    if (map->find_next_owned(start) != owned ||
+        map->find_next_path(start) != path ||
+        map->find_next_idle_serf(start) != idle_serf) {
+      std::cerr << "Invalid scan result from " << start << "\n";
+      errors += 1;
+    }
+  }
+
+  return errors;
+}
 
 int
 main(int argc, char *argv[]) {
   /* Print number of tests for TAP */
-  std::cout << "1..1" << "\n";
+  std::cout << "1..4" << "\n";
 
   int map_size = 3;
 
@@ -134,4 +256,27 @@ main(int argc, char *argv[]) {
   } else {
     std::cout << "ok 1 - Map is identical to memory dump.\n";
   }
+
+  map.init_tiles(generator);
+
+  errors = test_objects_near(&map, &random);
+  if (errors > 0) {
+    std::cout << "not ok 2 - Found " << errors << " missed objects!\n";
+  } else {
+    std::cout << "ok 2 - Objects near positions are found.\n";
+  }
+
+  errors = test_move(map);
+  if (errors > 0) {
+    std::cout << "not ok 3 - Found " << errors << " move errors!\n";
+  } else {
+    std::cout << "ok 3 - Moves match column and row arithmetic.\n";
+  }
+
+  errors = test_scans(&map, &random);
+  if (errors > 0) {
+    std::cout << "not ok 4 - Found " << errors << " scan errors!\n";
+  } else {
+    std::cout << "ok 4 - Map scans match plain loops.\n";
+  }
 }
@@ -0,0 +1,168 @@
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "src/objects.h"
+#include "src/random.h"
+
+class Item : public GameObject {
+ public:
+  Item(Game *game, unsigned int index) : GameObject(game, index) {}
+};
+
+typedef Collection<Item> Items;
+
+// Check that new objects take the lowest free index
+static int
+test_allocate() {
+  Items items(NULL);
+  int errors = 0;
+
+  for (unsigned int i = 0; i < 200; i++) {
+    Item *item = items.allocate();
+    if (item == NULL || item->get_index() != i) {
+      std::cerr << "Allocated wrong index for object " << i << "\n";
+      errors += 1;
+    }
+  }
+
+  items.erase(130);
+  items.erase(5);
+  items.erase(64);
+
+  const unsigned int expected[] = { 5, 64, 130, 200 };
+  for (int i = 0; i < 4; i++) {
+    Item *item = items.allocate();
+    if (item == NULL || item->get_index() != expected[i]) {
+      std::cerr << "Allocated wrong index, should have been " <<
+        expected[i] << "\n";
+      errors += 1;
+    }
+  }
+
+  if (items.size() != 201) {
+    std::cerr << "Invalid size " << items.size() << "\n";
+    errors += 1;
+  }
+
+  return errors;
+}
+
+// Check subset iteration against a plain loop over the indexes
+static int
+test_subset(Random *random) {
+  Items::Subset subset;
+  std::vector<bool> members(300, false);
+  int errors = 0;
+
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < 50; i++) {
+      unsigned int index = random->random() % members.size();
+      if (random->random() & 1) {
+        subset.insert(index);
+        members[index] = true;
+      } else {
+        subset.erase(index);
+        members[index] = false;
+      }
+    }
+
+    size_t count = 0;
+    for (unsigned int start = 0; start < members.size() + 70; start++) {
+      unsigned int expected = UINT_MAX;
+      for (unsigned int i = start; i < members.size(); i++) {
+        if (members[i]) {
+          expected = i;
+          break;
+        }
+      }
+
+      if (subset.next(start) != expected) {
+        std::cerr << "Invalid next member from " << start << "\n";
+        errors += 1;
+      }
+      if (start < members.size() && members[start]) count += 1;
+    }
+
+    if (subset.size() != count) {
+      std::cerr << "Invalid subset size " << subset.size() << "\n";
+      errors += 1;
+    }
+  }
+
+  return errors;
+}
+
+// Check Collection::next_excluding() against a plain loop over the indexes
+static int
+test_next_excluding(Random *random) {
+  Items items(NULL);
+  Items::Subset excluded;
+  const unsigned int max_index = 300;
+  int errors = 0;
+
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < 60; i++) {
+      unsigned int index = random->random() % max_index;
+      switch (random->random() % 3) {
+        case 0:
+          items.get_or_insert(index);
+          break;
+        case 1:
+          items.erase(index);
+          excluded.erase(index);
+          break;
+        case 2:
+          if (items.exists(index)) excluded.insert(index);
+          break;
+      }
+    }
+
+    for (unsigned int start = 0; start < max_index + 70; start++) {
+      unsigned int expected = UINT_MAX;
+      for (unsigned int i = start; i < max_index; i++) {
+        if (items.exists(i) && !excluded.contains(i)) {
+          expected = i;
+          break;
+        }
+      }
+
+      if (items.next_excluding(start, excluded) != expected) {
+        std::cerr << "Invalid next object from " << start << "\n";
+        errors += 1;
+      }
+    }
+  }
+
+  return errors;
+}
+
+int
+main() {
+  /* Print number of tests for TAP */
+  std::cout << "1..3" << "\n";
+
+  Random random = Random("8667715887436237");
+
+  int errors = test_allocate();
+  if (errors > 0) {
+    std::cout << "not ok 1 - Found " << errors << " allocation errors!\n";
+  } else {
+    std::cout << "ok 1 - Objects take the lowest free index.\n";
+  }
+
+  errors = test_subset(&random);
+  if (errors > 0) {
+    std::cout << "not ok 2 - Found " << errors << " subset errors!\n";
+  } else {
+    std::cout << "ok 2 - Subsets match plain loops.\n";
+  }
+
+  errors = test_next_excluding(&random);
+  if (errors > 0) {
+    std::cout << "not ok 3 - Found " << errors << " next_excluding errors!\n";
+  } else {
+    std::cout << "ok 3 - Next object excluding a subset matches plain loop.\n";
+  }
+}
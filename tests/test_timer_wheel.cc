@@ -0,0 +1,176 @@
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include "src/game.h"
+#include "src/random.h"
+
+typedef struct ExpectedTimer {
+  unsigned int tick;
+  bool expired;
+} ExpectedTimer;
+
+// Return a random tick offset from the current tick. The offsets reach
+// every level of the wheel, and past the range that the wheel covers.
+static int
+random_offset(Random *random) {
+  int offset = (random->random() << 16) | random->random();
+  switch (random->random() % 5) {
+    case 0: return -(offset % 4);
+    case 1: return offset % TIMER_WHEEL_SLOTS;
+    case 2: return offset % (TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS);
+    case 3: return offset % (1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS));
+    default: return offset % (4 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS));
+  }
+}
+
+// Check that timers expire at the first advance that reaches their tick,
+// while they are moved down through the levels of the wheel
+static int
+test_advance(unsigned int start, Random *random) {
+  TimerWheel wheel;
+  std::vector<ExpectedTimer> timers;
+  unsigned int current = start;
+  int errors = 0;
+
+  wheel.reset(start);
+
+  for (int round = 0; round < 200; round++) {
+    for (int i = 0; i < 20; i++) {
+      unsigned int tick = current + random_offset(random);
+      wheel.schedule(tick, static_cast<unsigned int>(timers.size()), 0);
+
+      // Timers that are already due fire on the next tick
+      if (static_cast<int>(tick - current) <= 0) tick = current + 1;
+      ExpectedTimer timer = { tick, false };
+      timers.push_back(timer);
+    }
+
+    unsigned int step = random->random() % 300;
+    if (round % 20 == 19) step = (random->random() << 10) % (1 << 26);
+    current += step;
+
+    std::vector<TimerWheel::Timer> expired;
+    wheel.advance(current, &expired);
+
+    std::vector<unsigned int> expired_ids;
+    for (size_t i = 0; i < expired.size(); i++) {
+      expired_ids.push_back(expired[i].id);
+    }
+    std::sort(expired_ids.begin(), expired_ids.end());
+
+    std::vector<unsigned int> expected_ids;
+    size_t pending = 0;
+    for (unsigned int id = 0; id < timers.size(); id++) {
+      if (timers[id].expired) continue;
+      if (static_cast<int>(timers[id].tick - current) <= 0) {
+        timers[id].expired = true;
+        expected_ids.push_back(id);
+      } else {
+        pending += 1;
+      }
+    }
+
+    if (expired_ids != expected_ids) {
+      std::cerr << "Invalid timers expired at tick " << current << ": " <<
+        expired_ids.size() << " should have been " << expected_ids.size() <<
+        "\n";
+      errors += 1;
+    }
+
+    if (wheel.size() != pending) {
+      std::cerr << "Invalid number of timers " << wheel.size() <<
+        " should have been " << pending << "\n";
+      errors += 1;
+    }
+  }
+
+  return errors;
+}
+
+// Check that every timer expires on exactly its tick while the wheel
+// is advanced one tick at a time. The ticks span the boundary between
+// the first two levels many times and the boundary between the last
+// two levels at least once, so timers are moved down from every level.
+static int
+test_exact(unsigned int start, Random *random) {
+  const unsigned int level_2 = TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS;
+  const unsigned int length = level_2 + 2 * TIMER_WHEEL_SLOTS;
+
+  TimerWheel wheel;
+  std::vector<unsigned int> timers;
+  int errors = 0;
+
+  wheel.reset(start);
+
+  for (unsigned int i = 0; i < 1000; i++) {
+    unsigned int offset = 1 + random->random() % (length - 1);
+    if (i % 4 == 0) offset = 1 + random->random() % (3 * TIMER_WHEEL_SLOTS);
+    wheel.schedule(start + offset, i, 0);
+    timers.push_back(start + offset);
+  }
+
+  for (unsigned int tick = start + 1; tick != start + length; tick++) {
+    std::vector<TimerWheel::Timer> expired;
+    wheel.advance(tick, &expired);
+
+    std::vector<unsigned int> expired_ids;
+    for (size_t i = 0; i < expired.size(); i++) {
+      expired_ids.push_back(expired[i].id);
+    }
+    std::sort(expired_ids.begin(), expired_ids.end());
+
+    std::vector<unsigned int> expected_ids;
+    for (unsigned int id = 0; id < timers.size(); id++) {
+      if (timers[id] == tick) expected_ids.push_back(id);
+    }
+
+    if (expired_ids != expected_ids) {
+      std::cerr << "Invalid timers expired at tick " << tick << ": " <<
+        expired_ids.size() << " should have been " << expected_ids.size() <<
+        "\n";
+      errors += 1;
+    }
+  }
+
+  if (wheel.size() != 0) {
+    std::cerr << wheel.size() << " timers never expired\n";
+    errors += 1;
+  }
+
+  return errors;
+}
+
+int
+main() {
+  /* Print number of tests for TAP */
+  std::cout << "1..3" << "\n";
+
+  Random random = Random("8667715887436237");
+
+  int errors = test_advance(0, &random);
+  if (errors > 0) {
+    std::cout << "not ok 1 - Found " << errors << " timer errors!\n";
+  } else {
+    std::cout << "ok 1 - Timers expire at their tick.\n";
+  }
+
+  // Start close to the end of the tick range to wrap around
+  errors = test_advance(0u - 5000, &random);
+  if (errors > 0) {
+    std::cout << "not ok 2 - Found " << errors << " timer errors!\n";
+  } else {
+    std::cout << "ok 2 - Timers expire at their tick across wrap around.\n";
+  }
+
+  // Start before the boundary between the last two levels
+  errors = test_exact(3 * TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS -
+                      TIMER_WHEEL_SLOTS - 10, &random);
+  if (errors > 0) {
+    std::cout << "not ok 3 - Found " << errors << " timer errors!\n";
+  } else {
+    std::cout << "ok 3 - Timers expire on exactly their tick.\n";
+  }
+}